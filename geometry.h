@@ -6,8 +6,12 @@
 #define GEOMETRY_H
 
 #include <assert.h>
+#include <float.h>
+#include <limits.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#include "misc.h"
 
 
 
@@ -42,6 +46,74 @@ static double polygon_area(const Point* poly, int n) {
 
 
 
+/**
+ * Batch kernels over point sets stored as separate x[] and y[] arrays, written
+ * as branch-free loops that vectorize with omp simd (SSE2, or AVX2 for the ones
+ * mixing int and double), and fall back to scalar code otherwise.
+ *
+ * _ Split an array of points: soa_split(pts, n, x, y);
+ * _ Area of a polygon (as polygon_area): soa_area(x, y, n);
+ * _ Distances from a segment to many points (as segment_point): soa_segment_point(&s, &e, x, y, n, dist, zero);
+ * _ Bounding box as {xmin, ymin, xmax, ymax}: soa_bbox(x, y, n, box);
+ * _ Side of many points from the line s->e (1=left, 0=on, -1=right): soa_orient(&s, &e, x, y, n, res, zero);
+ */
+static void soa_split(const Point* pts, int n, Point_unit* restrict x, Point_unit* restrict y) {
+	assert(pts!=NULL&&x!=NULL&&y!=NULL);
+	int i;
+	#pragma omp simd
+	for (i = 0; i < n; i++)
+		x[i] = pts[i].x, y[i] = pts[i].y;
+}
+static double soa_area(const Point_unit* restrict x, const Point_unit* restrict y, int n) {
+	assert(x!=NULL&&y!=NULL&&n>0);
+	Point_unit sum = x[n - 1] * y[0] - x[0] * y[n - 1];
+	int i;
+	#pragma omp simd reduction(+:sum)
+	for (i = 1; i < n; i++)
+		sum += x[i - 1] * y[i] - x[i] * y[i - 1];
+	return 0.5 * sum;
+}
+static void soa_segment_point(const Point* s, const Point* e, const Point_unit* restrict x, const Point_unit* restrict y, int n, double* restrict dist, Point_unit zero) {
+	assert(s!=NULL&&e!=NULL&&x!=NULL&&y!=NULL&&dist!=NULL);
+	const Point v = Point_sub(*e, *s);
+	const Point_unit sx = s->x, sy = s->y;
+	const double inv = (Point_L1(v) <= zero) ? 0.0 : 1.0 / Point_dot(v, v);
+	int i;
+	#pragma omp simd
+	for (i = 0; i < n; i++) { /* Clamps t to [0,1] without comparisons, which would not vectorize. */
+		double wx = x[i] - sx, wy = y[i] - sy, t = (v.x * wx + v.y * wy) * inv;
+		t = 0.5 * (fabs(t) - fabs(t - 1) + 1);
+		wx -= t * v.x, wy -= t * v.y;
+		dist[i] = wx * wx + wy * wy;
+	}
+	for (i = 0; i < n; i++) /* Vectorizes only without errno (-fno-math-errno). */
+		dist[i] = sqrt(dist[i]);
+}
+static void soa_bbox(const Point_unit* restrict x, const Point_unit* restrict y, int n, Point_unit box[4]) {
+	assert(x!=NULL&&y!=NULL&&n>0);
+	Point_unit xmin = x[0], ymin = y[0], xmax = x[0], ymax = y[0];
+	int i;
+	#pragma omp simd reduction(min:xmin,ymin) reduction(max:xmax,ymax)
+	for (i = 1; i < n; i++) {
+		xmin = pmin(xmin, x[i]), ymin = pmin(ymin, y[i]);
+		xmax = pmax(xmax, x[i]), ymax = pmax(ymax, y[i]);
+	}
+	box[0] = xmin, box[1] = ymin, box[2] = xmax, box[3] = ymax;
+}
+static void soa_orient(const Point* s, const Point* e, const Point_unit* restrict x, const Point_unit* restrict y, int n, int* restrict res, Point_unit zero) {
+	assert(s!=NULL&&e!=NULL&&x!=NULL&&y!=NULL&&res!=NULL);
+	const Point v = Point_sub(*e, *s);
+	const Point_unit sx = s->x, sy = s->y, limit = zero * Point_L1(v);
+	int i;
+	#pragma omp simd
+	for (i = 0; i < n; i++) {
+		Point_unit cross = v.x * (y[i] - sy) - (x[i] - sx) * v.y;
+		res[i] = (cross > limit) - (cross < -limit);
+	}
+}
+
+
+
 /* Point in polygon query (-1=border, 0=out, 1=in). */
 static int pip_mask(Point p, Point_unit z) { return ((p.x < -z) << 3) | ((p.x > z) << 2) | ((p.y < -z) << 1) | (p.y > z); }
 static const int pip_inc[11][11] = {{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
@@ -71,6 +143,100 @@ static int point_in_polygon(const Point* p, const Point* poly, int n, Point_unit
 
 
 
+/**
+ * Index a polygon for many point in polygon queries (-1=border, 0=out, 1=in),
+ * cutting it in horizontal bands that list the edges they overlap, so that a
+ * query only visits the edges of one band. O(n + edges per band)
+ *
+ * _ An edge is stored in every band it spans, so the bands are halved until
+ *   at most 4n edges are stored, keeping the memory in O(n + bands).
+ * _ Build the index with around n/4 bands (returns 0, or -1 if memory is lacking):
+ *   PIP_index idx; pip_init(&idx, poly, n, bands, zero);
+ * _ Query one point: pip_query(&idx, &p);
+ * _ Classify an array of points (in parallel with -fopenmp): pip_batch(&idx, pts, num, res);
+ * _ The winding number is counted on the edges crossing the horizontal ray
+ *   from p, which are stored per band as separate coordinate arrays so that
+ *   the loop vectorizes. Results are those of point_in_polygon.
+ */
+typedef struct { int bands, *first; Point_unit ymin, ymax, step, zero, *x0, *y0, *x1, *y1; } PIP_index;
+static int pip_band(const PIP_index* idx, Point_unit y) {
+	double b = floor((y - idx->ymin) / idx->step);
+	return (b < 0) ? 0 : (b >= idx->bands) ? idx->bands - 1 : (int)b;
+}
+static int pip_init(PIP_index* idx, const Point* poly, int n, int bands, Point_unit zero) {
+	assert(idx!=NULL&&poly!=NULL&&n>0&&bands>0);
+	int i, b, last, old;
+	size_t stored;
+	idx->zero = zero;
+	idx->ymin = idx->ymax = poly[0].y;
+	for (i = 1; i < n; i++)
+		idx->ymin = pmin(idx->ymin, poly[i].y), idx->ymax = pmax(idx->ymax, poly[i].y);
+	for (;; bands = (bands + 1) / 2) {
+		idx->bands = bands;
+		idx->step = (idx->ymax > idx->ymin) ? (idx->ymax - idx->ymin) / bands : 1;
+		for (stored = 0, old = n - 1, i = 0; i < n; old = i++)
+			stored += pip_band(idx, pmax(poly[old].y, poly[i].y) + zero) - pip_band(idx, pmin(poly[old].y, poly[i].y) - zero) + 1;
+		if (stored <= 4 * (size_t)n || bands == 1)
+			break;
+	}
+	if ((idx->first = calloc(bands + 1, sizeof(int))) == NULL)
+		return -1;
+	for (old = n - 1, i = 0; i < n; old = i++) {
+		last = pip_band(idx, pmax(poly[old].y, poly[i].y) + zero);
+		for (b = pip_band(idx, pmin(poly[old].y, poly[i].y) - zero); b <= last; b++)
+			idx->first[b + 1]++;
+	}
+	for (b = 0; b < bands; b++)
+		idx->first[b + 1] += idx->first[b];
+	idx->x0 = malloc(idx->first[bands] * 4 * sizeof(Point_unit));
+	if (idx->x0 == NULL) {
+		free(idx->first);
+		return -1;
+	}
+	idx->y0 = idx->x0 + idx->first[bands], idx->x1 = idx->y0 + idx->first[bands], idx->y1 = idx->x1 + idx->first[bands];
+	for (old = n - 1, i = 0; i < n; old = i++) {
+		last = pip_band(idx, pmax(poly[old].y, poly[i].y) + zero);
+		for (b = pip_band(idx, pmin(poly[old].y, poly[i].y) - zero); b <= last; b++) {
+			int e = idx->first[b]++;
+			idx->x0[e] = poly[old].x, idx->y0[e] = poly[old].y, idx->x1[e] = poly[i].x, idx->y1[e] = poly[i].y;
+		}
+	}
+	for (b = bands; b > 0; b--)
+		idx->first[b] = idx->first[b - 1];
+	idx->first[0] = 0;
+	return 0;
+}
+static void pip_free(PIP_index* idx) { free(idx->first), free(idx->x0), idx->first = NULL, idx->x0 = NULL; }
+static int pip_query(const PIP_index* idx, const Point* p) {
+	assert(idx!=NULL&&p!=NULL);
+	const Point_unit z = idx->zero, px = p->x, py = p->y;
+	int b, e, end, winding = 0, border = 0;
+	if (py < idx->ymin - z || py > idx->ymax + z)
+		return 0;
+	b = pip_band(idx, py), end = idx->first[b + 1];
+	#pragma omp simd reduction(+:winding) reduction(|:border)
+	for (e = idx->first[b]; e < end; e++) {
+		Point_unit ax = idx->x0[e] - px, ay = idx->y0[e] - py, bx = idx->x1[e] - px, by = idx->y1[e] - py;
+		Point_unit cross = ax * by - bx * ay;
+		winding += ((ay <= 0) & (by > 0) & (cross > 0)) - ((by <= 0) & (ay > 0) & (cross < 0));
+		border |= !((ax < -z) & (bx < -z)) & !((ax > z) & (bx > z)) & !((ay < -z) & (by < -z)) & !((ay > z) & (by > z)) &
+			(fabs(cross) <= z * (fabs(bx - ax) + fabs(by - ay)));
+		border |= ((fabs(ax) <= z) & (fabs(ay) <= z)) | ((fabs(bx) <= z) & (fabs(by) <= z));
+	}
+	return border ? -1 : (winding != 0);
+}
+static void pip_batch(const PIP_index* idx, const Point* pts, int num, int* res) {
+	assert(idx!=NULL&&pts!=NULL&&res!=NULL);
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for (i = 0; i < num; i++)
+		res[i] = pip_query(idx, pts + i);
+}
+
+
+
 /* Intersection of two segments. Returns the number of points found (0 to 2). */
 static int segment_intersection(const Point* s1, const Point* e1, const Point* s2, const Point* e2, double i[2][2], Point_unit zero) {
 	const Point v1 = Point_sub(*e1, *s1), v2 = Point_sub(*e2, *s2), w = Point_sub(*s2, *s1), *i1, *i2;
@@ -121,4 +287,516 @@ static double segment_segment(const Point* s1, const Point* e1, const Point* s2,
 	return (d1 < d2) ? d1 : d2;
 }
 
+
+
+/**
+ * Find all the intersections among n segments with the Bentley-Ottmann sweep,
+ * as in de Berg et al.: a vertical line goes over the endpoints and crossings
+ * in (x, y) order, with the segments it cuts kept ordered by y in a treap, so
+ * that only neighbours are tested. O((n + k) log n) for k pairs
+ *
+ * _ Begin with the segments from s[i] to e[i]
+ * _ Get the intersecting pairs (a < b, with the points of segment_intersection)
+ *   in a malloc'd array, returning their number (or -1 if memory is lacking):
+ *   Segment_cross* res; int k = segment_intersections(s, e, n, zero, &res);
+ * _ The segments through each event point are reported pairwise, then the
+ *   remaining ones are reordered by slope, so endpoints on other segments,
+ *   collinear overlaps, vertical segments and many segments through one point
+ *   are all handled.
+ * _ Pairs are reported as by a brute force loop over segment_intersection
+ *   when the segments touch or cross (zero may be 0, as the test for being on
+ *   a segment allows for the rounding of crossings). Pairs that only come
+ *   within zero of each other are found only if they become neighbours.
+ */
+typedef struct { int a, b, count; double i[2][2]; } Segment_cross;
+typedef struct { Point p; int i, end; } Segment_end;
+typedef struct { Point l, r, v; double n, slack; } Segment_line;
+typedef struct { const Segment_line* g; int* kid; Point p; Point_unit zero; double tol; } Segment_sweep;
+#define Segment_before(a, b) ((a).x < (b).x || ((a).x == (b).x && (a).y < (b).y))
+HEAP(Segment_heap, Point, Segment_before)
+static int Segment_end_comp(const void* a, const void* b) {
+	const Segment_end *u = a, *v = b;
+	return Segment_before(u->p, v->p) ? -1 : Segment_before(v->p, u->p) ? 1 : 0;
+}
+static void Segment_split(const Segment_sweep* S, int t, int through, int* below, int* above) { /* By side of p. */
+	while (t >= 0) {
+		const Segment_line* g = S->g + t;
+		Point_unit side = Point_cross(g->v, Point_sub(S->p, g->l));
+		double tol = S->tol * g->n + g->slack;
+		if (side > tol || (through && side >= -tol))
+			*below = t, below = S->kid + 2 * t + 1, t = *below;
+		else
+			*above = t, above = S->kid + 2 * t, t = *above;
+	}
+	*below = *above = -1;
+}
+static int Segment_merge(int* kid, const unsigned* pri, int a, int b) {
+	if (a < 0 || b < 0)
+		return (a < 0) ? b : a;
+	if (pri[a] > pri[b])
+		return kid[2 * a + 1] = Segment_merge(kid, pri, kid[2 * a + 1], b), a;
+	return kid[2 * b] = Segment_merge(kid, pri, a, kid[2 * b]), b;
+}
+static void Segment_collect(const int* kid, int t, int* out, int* m) {
+	if (t >= 0)
+		Segment_collect(kid, kid[2 * t], out, m), out[(*m)++] = t, Segment_collect(kid, kid[2 * t + 1], out, m);
+}
+static int Segment_crossing(const Segment_sweep* S, int a, int b, Point** heap, size_t* num, size_t* cap) { /* Queue a crossing after p. */
+	double i[2][2];
+	Point q, *tmp;
+	if (a < 0 || b < 0 || segment_intersection(&S->g[a].l, &S->g[a].r, &S->g[b].l, &S->g[b].r, i, S->zero) != 1)
+		return 0;
+	q.x = i[0][0], q.y = i[0][1];
+	if (!Segment_before(S->p, q))
+		return 0;
+	if (*num == *cap) {
+		if ((tmp = realloc(*heap, (*cap * 2 + 64) * sizeof(*tmp))) == NULL)
+			return -1;
+		*heap = tmp, *cap = *cap * 2 + 64;
+	}
+	Segment_heap_push(*heap, num, q);
+	return 0;
+}
+static int segment_intersections(const Point* s, const Point* e, int n, Point_unit zero, Segment_cross** res) {
+	assert(s!=NULL&&e!=NULL&&n>=0&&res!=NULL);
+	Segment_line* g = malloc((size_t)n * sizeof(*g) + 1);
+	Segment_end* ends = malloc(2 * (size_t)n * sizeof(*ends) + 1);
+	int *kid = malloc(4 * (size_t)n * sizeof(*kid) + 1), *mid = kid + 2 * n, *gone = kid + 3 * n, *order = NULL;
+	unsigned* pri = malloc((size_t)n * sizeof(*pri) + 1);
+	long long *pairs = NULL, *grown;
+	Point* queue = NULL;
+	Segment_cross* cross = NULL;
+	size_t queued = 0, queue_cap = 0, num = 0, cap = 0, next = 0, i, j;
+	unsigned long long seed = 88172645463325252ULL;
+	int root = -1, below, through, above, m, k, a, b, ok = 1;
+	Segment_sweep S = {g, kid, {0, 0}, zero, 0};
+	*res = NULL;
+	if (g == NULL || ends == NULL || kid == NULL || pri == NULL) {
+		free(g), free(ends), free(kid), free(pri);
+		return -1;
+	}
+	for (a = 0; a < n; a++) {
+		b = Segment_before(e[a], s[a]);
+		g[a].l = b ? e[a] : s[a], g[a].r = b ? s[a] : e[a], g[a].v = Point_sub(g[a].r, g[a].l);
+		g[a].n = Point_L1(g[a].v), g[a].slack = 8 * DBL_EPSILON * Point_L1(g[a].l) * g[a].n; /* Crossings are rounded. */
+		ends[2 * a].p = g[a].l, ends[2 * a].i = a, ends[2 * a].end = 0;
+		ends[2 * a + 1].p = g[a].r, ends[2 * a + 1].i = a, ends[2 * a + 1].end = 1;
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL, pri[a] = seed >> 33, gone[a] = 0;
+	}
+	qsort(ends, 2 * (size_t)n, sizeof(*ends), Segment_end_comp);
+	while (ok && (next < 2 * (size_t)n || queued > 0)) {
+		S.p = (queued == 0 || (next < 2 * (size_t)n && !Segment_before(queue[0], ends[next].p))) ? ends[next].p : queue[0];
+		S.tol = zero + 8 * DBL_EPSILON * Point_L1(S.p);
+		while (queued > 0 && !Segment_before(S.p, queue[0])) /* The same crossing may be queued more than once. */
+			Segment_heap_pop(queue, &queued);
+		Segment_split(&S, root, 0, &below, &through);
+		Segment_split(&S, through, 1, &through, &above);
+		m = 0, Segment_collect(kid, through, mid, &m);
+		for (; next < 2 * (size_t)n && !Segment_before(S.p, ends[next].p); next++) {
+			a = ends[next].i;
+			if (!ends[next].end && !Segment_before(g[a].l, g[a].r)) /* A single point, never inserted. */
+				mid[m++] = a, gone[a] = 1;
+			else if (ends[next].end)
+				gone[a] = 1;
+			else
+				mid[m++] = a;
+		}
+		if (num + (size_t)m * m / 2 > cap) {
+			if ((grown = realloc(pairs, (cap * 2 + (size_t)m * m / 2 + 64) * sizeof(*pairs))) == NULL) {
+				ok = 0;
+				break;
+			}
+			pairs = grown, cap = cap * 2 + (size_t)m * m / 2 + 64;
+		}
+		for (a = 0; a < m; a++) { /* Every segment through p meets every other. */
+			for (b = a + 1; b < m; b++)
+				pairs[num++] = (mid[a] < mid[b]) ? (long long)mid[a] * n + mid[b] : (long long)mid[b] * n + mid[a];
+		}
+		for (a = k = 0; a < m; a++) { /* The others by slope just after p, by insertion as m^2 pairs were reported. */
+			if (gone[mid[a]])
+				continue;
+			for (through = mid[a], b = k; b > 0; b--) {
+				Point_unit t = Point_cross(g[mid[b - 1]].v, g[through].v);
+				if (t > 0 || (t == 0 && mid[b - 1] < through))
+					break;
+				mid[b] = mid[b - 1];
+			}
+			mid[b] = through, k++;
+		}
+		for (through = -1, a = 0; a < k; a++)
+			kid[2 * mid[a]] = kid[2 * mid[a] + 1] = -1, through = Segment_merge(kid, pri, through, mid[a]);
+		for (a = below; a >= 0 && kid[2 * a + 1] >= 0; a = kid[2 * a + 1]);
+		for (b = above; b >= 0 && kid[2 * b] >= 0; b = kid[2 * b]);
+		if (k == 0)
+			ok = (Segment_crossing(&S, a, b, &queue, &queued, &queue_cap) == 0);
+		else
+			ok = (Segment_crossing(&S, a, mid[0], &queue, &queued, &queue_cap) == 0 && Segment_crossing(&S, mid[k - 1], b, &queue, &queued, &queue_cap) == 0);
+		root = Segment_merge(kid, pri, Segment_merge(kid, pri, below, through), above);
+	}
+	free(g), free(ends), free(kid), free(pri), free(queue);
+	if (ok && num > 0) /* Pairs meeting at several points were found at each. */
+		ok = ((order = calloc(num, sizeof(*order))) != NULL && radix_sort64(pairs, order, num) == 0);
+	for (i = j = 0; ok && i < num; i++)
+		j += (i == 0 || pairs[i] != pairs[i - 1]), pairs[j - 1] = pairs[i];
+	if (ok && j > 0)
+		ok = ((cross = malloc(j * sizeof(*cross))) != NULL);
+	for (num = 0, i = 0; ok && i < j; i++) {
+		a = pairs[i] / n, b = pairs[i] % n;
+		cross[num].a = a, cross[num].b = b, cross[num].count = segment_intersection(s + a, e + a, s + b, e + b, cross[num].i, zero);
+		num += (cross[num].count > 0);
+	}
+	free(pairs), free(order);
+	if (!ok) {
+		free(cross);
+		return -1;
+	}
+	*res = cross;
+	return num;
+}
+
+
+
+/**
+ * Index segments for nearest and radius queries, in an implicit tree of boxes:
+ * the segments are sorted along a Hilbert curve and cut in leaves of SEG_LEAF,
+ * node k (from 1) having children 2k and 2k+1, as in a heap. O(log n) per query
+ *
+ * _ Build the index of segments s[i]->e[i] (returns 0, or -1 if memory is lacking):
+ *   Seg_index idx; seg_init(&idx, s, e, n);
+ * _ Nearest segment to p with its distance (-1 if n == 0): int i = seg_nearest(&idx, &p, &dist, zero);
+ * _ Segments within r of p, writing the first cap and returning their number:
+ *   int k = seg_radius(&idx, &p, r, res, cap, zero);
+ * _ Nearest segments to many points, queried in Hilbert order so that each
+ *   starts from the result of the previous one (in parallel with -fopenmp):
+ *   seg_nearest_batch(&idx, pts, num, res, dist, zero);
+ */
+enum { SEG_LEAF = 8 };
+typedef struct { Point_unit xmin, ymin, xmax, ymax; } Seg_box;
+typedef struct { int n, leaves, *id; Seg_box* box; Point *s, *e; } Seg_index;
+static long long hilbert_key(const Seg_box* b, Point p) {
+	const unsigned n = 1 << 16;
+	double fx = (b->xmax > b->xmin) ? (p.x - b->xmin) / (b->xmax - b->xmin) * (n - 1) : 0;
+	double fy = (b->ymax > b->ymin) ? (p.y - b->ymin) / (b->ymax - b->ymin) * (n - 1) : 0;
+	unsigned x = (fx < 0) ? 0 : (fx > n - 1) ? n - 1 : fx, y = (fy < 0) ? 0 : (fy > n - 1) ? n - 1 : fy, rx, ry, s, t;
+	long long d = 0;
+	for (s = n / 2; s > 0; s /= 2) {
+		rx = (x & s) > 0, ry = (y & s) > 0;
+		d += (long long)s * s * ((3 * rx) ^ ry);
+		if (ry == 0) {
+			if (rx == 1)
+				x = n - 1 - x, y = n - 1 - y;
+			t = x, x = y, y = t;
+		}
+	}
+	return d;
+}
+static double seg_box_dist(const Seg_box* b, const Point* p) {
+	double dx = pmax(pmax(b->xmin - p->x, p->x - b->xmax), 0), dy = pmax(pmax(b->ymin - p->y, p->y - b->ymax), 0);
+	return sqrt(dx * dx + dy * dy);
+}
+static void seg_free(Seg_index* idx) {
+	free(idx->id), free(idx->box), free(idx->s), free(idx->e);
+	idx->id = NULL, idx->box = NULL, idx->s = idx->e = NULL;
+}
+static int seg_init(Seg_index* idx, const Point* s, const Point* e, int n) {
+	assert(idx!=NULL&&s!=NULL&&e!=NULL&&n>=0);
+	const Seg_box empty = {HUGE_VAL, HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+	long long* keys = malloc(n * sizeof(*keys) + 1);
+	int i, k;
+	Seg_box* b;
+	for (idx->n = n, idx->leaves = 1; idx->leaves * SEG_LEAF < n; idx->leaves *= 2);
+	idx->id = malloc(n * sizeof(int) + 1), idx->s = malloc(n * sizeof(Point) + 1), idx->e = malloc(n * sizeof(Point) + 1);
+	idx->box = malloc(2 * idx->leaves * sizeof(Seg_box));
+	if (keys == NULL || idx->id == NULL || idx->s == NULL || idx->e == NULL || idx->box == NULL) {
+		free(keys), seg_free(idx);
+		return -1;
+	}
+	for (b = idx->box + 1, *b = empty, i = 0; i < n; i++) {
+		b->xmin = pmin(b->xmin, pmin(s[i].x, e[i].x)), b->xmax = pmax(b->xmax, pmax(s[i].x, e[i].x));
+		b->ymin = pmin(b->ymin, pmin(s[i].y, e[i].y)), b->ymax = pmax(b->ymax, pmax(s[i].y, e[i].y));
+	}
+	for (i = 0; i < n; i++)
+		keys[i] = hilbert_key(b, Point_mul(Point_add(s[i], e[i]), 0.5)), idx->id[i] = i;
+	if (radix_sort64(keys, idx->id, n) < 0) {
+		free(keys), seg_free(idx);
+		return -1;
+	}
+	free(keys);
+	for (i = 0; i < n; i++)
+		idx->s[i] = s[idx->id[i]], idx->e[i] = e[idx->id[i]];
+	for (k = idx->leaves; k < 2 * idx->leaves; k++) {
+		for (b = idx->box + k, *b = empty, i = (k - idx->leaves) * SEG_LEAF; i < n && i < (k - idx->leaves + 1) * SEG_LEAF; i++) {
+			b->xmin = pmin(b->xmin, pmin(idx->s[i].x, idx->e[i].x)), b->xmax = pmax(b->xmax, pmax(idx->s[i].x, idx->e[i].x));
+			b->ymin = pmin(b->ymin, pmin(idx->s[i].y, idx->e[i].y)), b->ymax = pmax(b->ymax, pmax(idx->s[i].y, idx->e[i].y));
+		}
+	}
+	for (k = idx->leaves - 1; k > 0; k--) {
+		const Seg_box *l = idx->box + 2 * k, *r = l + 1;
+		idx->box[k].xmin = pmin(l->xmin, r->xmin), idx->box[k].xmax = pmax(l->xmax, r->xmax);
+		idx->box[k].ymin = pmin(l->ymin, r->ymin), idx->box[k].ymax = pmax(l->ymax, r->ymax);
+	}
+	return 0;
+}
+static int seg_search(const Seg_index* idx, const Point* p, double* best, int res, Point_unit zero) {
+	int stack[64], top = 0, k, i, end;
+	double d, dl, dr;
+	for (stack[top++] = 1; top > 0; ) {
+		if (seg_box_dist(idx->box + (k = stack[--top]), p) >= *best)
+			continue;
+		if (k >= idx->leaves) {
+			for (i = (k - idx->leaves) * SEG_LEAF, end = (i + SEG_LEAF < idx->n) ? i + SEG_LEAF : idx->n; i < end; i++)
+				if ((d = segment_point(idx->s + i, idx->e + i, p, zero)) < *best)
+					*best = d, res = i;
+			continue;
+		}
+		dl = seg_box_dist(idx->box + 2 * k, p), dr = seg_box_dist(idx->box + 2 * k + 1, p);
+		stack[top++] = 2 * k + (dl < dr), stack[top++] = 2 * k + (dl >= dr);
+	}
+	return res;
+}
+static int seg_nearest(const Seg_index* idx, const Point* p, double* dist, Point_unit zero) {
+	assert(idx!=NULL&&p!=NULL&&dist!=NULL);
+	int i;
+	*dist = HUGE_VAL;
+	i = seg_search(idx, p, dist, -1, zero);
+	return (i < 0) ? -1 : idx->id[i];
+}
+static int seg_radius(const Seg_index* idx, const Point* p, double r, int* res, int cap, Point_unit zero) {
+	assert(idx!=NULL&&p!=NULL&&(res!=NULL||cap==0));
+	int stack[64], top = 0, k, i, end, num = 0;
+	for (stack[top++] = 1; top > 0; ) {
+		if (seg_box_dist(idx->box + (k = stack[--top]), p) > r)
+			continue;
+		if (k < idx->leaves) {
+			stack[top++] = 2 * k + 1, stack[top++] = 2 * k;
+			continue;
+		}
+		for (i = (k - idx->leaves) * SEG_LEAF, end = (i + SEG_LEAF < idx->n) ? i + SEG_LEAF : idx->n; i < end; i++)
+			if (segment_point(idx->s + i, idx->e + i, p, zero) <= r && num++ < cap)
+				res[num - 1] = idx->id[i];
+	}
+	return num;
+}
+static int seg_nearest_batch(const Seg_index* idx, const Point* pts, int num, int* res, double* dist, Point_unit zero) {
+	assert(idx!=NULL&&pts!=NULL&&res!=NULL&&dist!=NULL);
+	long long* keys = malloc(num * sizeof(*keys) + 1);
+	int *order = malloc(num * sizeof(*order) + 1), b, i, j, prev;
+	if (keys == NULL || order == NULL) {
+		free(keys), free(order);
+		return -1;
+	}
+	for (i = 0; i < num; i++)
+		keys[i] = hilbert_key(idx->box + 1, pts[i]), order[i] = i;
+	if (radix_sort64(keys, order, num) < 0) {
+		free(keys), free(order);
+		return -1;
+	}
+	free(keys);
+	#ifdef _OPENMP
+	#pragma omp parallel for private(i, j, prev) schedule(dynamic)
+	#endif
+	for (b = 0; b < num; b += 256) {
+		for (prev = -1, i = b; i < num && i < b + 256; i++) {
+			j = order[i];
+			dist[j] = (prev < 0) ? HUGE_VAL : segment_point(idx->s + prev, idx->e + prev, pts + j, zero);
+			prev = seg_search(idx, pts + j, dist + j, prev, zero);
+			res[j] = (prev < 0) ? -1 : idx->id[prev];
+		}
+	}
+	free(order);
+	return 0;
+}
+
+
+
+/**
+ * Convex hull with Andrew's monotone chain, after discarding the points inside
+ * the quadrilateral of extreme points and radix sorting the others. O(n)
+ *
+ * _ Begin with hull an array of n+1 points
+ * _ Get the hull counter-clockwise without collinear points, returning its
+ *   size (1 if all points are the same, or -1 if memory is lacking), pts
+ *   being reordered:
+ *   int h = convex_hull(pts, n, hull, zero);
+ * _ point_sort(pts, n) sorts points by x then y, with two stable radix passes
+ *   on the bits of the coordinates.
+ */
+static long long point_key(Point_unit d) {
+	long long b;
+	memcpy(&b, &d, sizeof(b));
+	return b ^ ((b >> 63) & LLONG_MAX);
+}
+static int point_sort(Point* pts, int n) {
+	assert(pts!=NULL);
+	long long* keys = malloc(n * sizeof(*keys));
+	int *idx = malloc(n * sizeof(*idx)), i, res = -1;
+	Point* tmp = malloc(n * sizeof(*tmp));
+	if (keys != NULL && idx != NULL && tmp != NULL) {
+		for (i = 0; i < n; i++)
+			keys[i] = point_key(pts[i].y), idx[i] = i;
+		if (radix_sort64(keys, idx, n) == 0) {
+			for (i = 0; i < n; i++)
+				keys[i] = point_key(pts[idx[i]].x);
+			if (radix_sort64(keys, idx, n) == 0) {
+				for (i = 0; i < n; i++)
+					tmp[i] = pts[idx[i]];
+				memcpy(pts, tmp, n * sizeof(*pts));
+				res = 0;
+			}
+		}
+	}
+	free(tmp), free(idx), free(keys);
+	return res;
+}
+static int convex_hull(Point* pts, int n, Point* hull, Point_unit zero) {
+	assert(pts!=NULL&&hull!=NULL);
+	Point q[4];
+	int i, k, t, m = 0;
+	if (n <= 0)
+		return 0;
+	for (q[0] = q[1] = q[2] = q[3] = pts[0], i = 1; i < n; i++) {
+		q[0] = (pts[i].x < q[0].x) ? pts[i] : q[0];
+		q[1] = (pts[i].y < q[1].y) ? pts[i] : q[1];
+		q[2] = (pts[i].x > q[2].x) ? pts[i] : q[2];
+		q[3] = (pts[i].y > q[3].y) ? pts[i] : q[3];
+	}
+	for (i = 0; i < n; i++) { /* Keep the points not strictly inside q. */
+		for (k = 0; k < 4 && Point_cross(Point_sub(q[(k + 1) & 3], q[k]), Point_sub(pts[i], q[k])) > zero; k++);
+		if (k < 4) {
+			Point p = pts[m];
+			pts[m++] = pts[i], pts[i] = p;
+		}
+	}
+	if (point_sort(pts, m) < 0)
+		return -1;
+	if (Point_L1(Point_sub(pts[m - 1], pts[0])) <= zero) /* All the points are the same. */
+		return hull[0] = pts[0], 1;
+	for (i = k = 0; i < m; hull[k++] = pts[i++])
+		while (k >= 2 && Point_cross(Point_sub(hull[k - 1], hull[k - 2]), Point_sub(pts[i], hull[k - 2])) <= zero * Point_L1(Point_sub(pts[i], hull[k - 2])))
+			k--;
+	for (i = m - 2, t = k + 1; i >= 0; hull[k++] = pts[i--])
+		while (k >= t && Point_cross(Point_sub(hull[k - 1], hull[k - 2]), Point_sub(pts[i], hull[k - 2])) <= zero * Point_L1(Point_sub(pts[i], hull[k - 2])))
+			k--;
+	return k - (k > 1);
+}
+
+
+
+/**
+ * Rotating calipers on a convex polygon (counter-clockwise, as from convex_hull). O(n)
+ *
+ * _ Diameter, with the indices of the farthest points: hull_diameter(hull, h, &i, &j);
+ * _ Minimal width between two parallel lines: hull_width(hull, h);
+ * _ Minimal area enclosing rectangle, with its corners (rect is left unset if
+ *   h is 0): hull_min_rect(hull, h, rect);
+ */
+static int hull_next(int i, int h) { return (i + 1 < h) ? i + 1 : 0; }
+static Point_unit hull_height(const Point* hull, int i, int h, int j) {
+	return Point_cross(Point_sub(hull[hull_next(i, h)], hull[i]), Point_sub(hull[j], hull[i]));
+}
+static double hull_diameter(const Point* hull, int h, int* a, int* b) {
+	assert(hull!=NULL&&a!=NULL&&b!=NULL);
+	double best = 0, d;
+	int i, j = 1;
+	for (*a = *b = 0, i = 0; i < h && h > 1; i++) {
+		while (hull_height(hull, i, h, hull_next(j, h)) > hull_height(hull, i, h, j))
+			j = hull_next(j, h);
+		if ((d = Point_L2(Point_sub(hull[j], hull[i]))) > best)
+			best = d, *a = i, *b = j;
+		if ((d = Point_L2(Point_sub(hull[j], hull[hull_next(i, h)]))) > best)
+			best = d, *a = hull_next(i, h), *b = j;
+	}
+	return best;
+}
+static double hull_width(const Point* hull, int h) {
+	assert(hull!=NULL);
+	double best = HUGE_VAL, d;
+	int i, j = 1;
+	for (i = 0; i < h && h > 2; i++) {
+		while (hull_height(hull, i, h, hull_next(j, h)) > hull_height(hull, i, h, j))
+			j = hull_next(j, h);
+		d = hull_height(hull, i, h, j) / Point_L2(Point_sub(hull[hull_next(i, h)], hull[i]));
+		best = (d < best) ? d : best;
+	}
+	return (h > 2) ? best : 0.0;
+}
+static double hull_min_rect(const Point* hull, int h, Point rect[4]) {
+	assert(hull!=NULL&&rect!=NULL);
+	double best = HUGE_VAL, len, lo, hi, up;
+	int i, j = 1, k = 1, l = 1;
+	Point u, v;
+	if (h <= 0)
+		return 0.0;
+	if (h < 3) {
+		rect[0] = rect[3] = hull[0], rect[1] = rect[2] = hull[h - 1];
+		return 0.0;
+	}
+	for (i = 0; i < h; i++) {
+		u = Point_sub(hull[hull_next(i, h)], hull[i]);
+		while (Point_dot(u, hull[hull_next(k, h)]) > Point_dot(u, hull[k]))
+			k = hull_next(k, h);
+		for (j = (i == 0) ? k : j; hull_height(hull, i, h, hull_next(j, h)) > hull_height(hull, i, h, j); j = hull_next(j, h));
+		for (l = (i == 0) ? j : l; Point_dot(u, hull[hull_next(l, h)]) < Point_dot(u, hull[l]); l = hull_next(l, h));
+		len = Point_L2(u), u = Point_mul(u, 1.0 / len), v.x = -u.y, v.y = u.x;
+		lo = Point_dot(u, Point_sub(hull[l], hull[i])), hi = Point_dot(u, Point_sub(hull[k], hull[i]));
+		up = Point_dot(v, Point_sub(hull[j], hull[i]));
+		if ((hi - lo) * up < best) {
+			best = (hi - lo) * up;
+			rect[0] = Point_add(hull[i], Point_mul(u, lo)), rect[1] = Point_add(hull[i], Point_mul(u, hi));
+			rect[2] = Point_add(rect[1], Point_mul(v, up)), rect[3] = Point_add(rect[0], Point_mul(v, up));
+		}
+	}
+	return best;
+}
+
+
+
+/**
+ * Closest pair of points, by divide and conquer on the points sorted by x,
+ * merging them by y on return. O(n log n)
+ *
+ * _ Get the distance and the pair, pts being reordered (returns -1 if memory
+ *   is lacking): closest_pair(pts, n, pair);
+ */
+static double closest_rec(Point* pts, int n, Point* buf, double best, Point pair[2]) {
+	int mid = n / 2, i, j, k, m;
+	Point_unit x = pts[mid].x;
+	double d;
+	if (n <= 3) {
+		for (i = 0; i < n; i++)
+			for (j = i + 1; j < n; j++)
+				if ((d = Point_L2(Point_sub(pts[i], pts[j]))) < best)
+					best = d, pair[0] = pts[i], pair[1] = pts[j];
+		for (i = 1; i < n; i++)
+			for (j = i; j > 0 && pts[j].y < pts[j - 1].y; j--)
+				buf[0] = pts[j], pts[j] = pts[j - 1], pts[j - 1] = buf[0];
+		return best;
+	}
+	best = closest_rec(pts, mid, buf, best, pair);
+	best = closest_rec(pts + mid, n - mid, buf, best, pair);
+	for (i = 0, j = mid, k = 0; i < mid || j < n; )
+		buf[k++] = (j == n || (i < mid && pts[i].y <= pts[j].y)) ? pts[i++] : pts[j++];
+	memcpy(pts, buf, n * sizeof(*pts));
+	for (i = m = 0; i < n; i++) {
+		if (fabs(pts[i].x - x) >= best)
+			continue;
+		for (j = m - 1; j >= 0 && pts[i].y - buf[j].y < best; j--)
+			if ((d = Point_L2(Point_sub(pts[i], buf[j]))) < best)
+				best = d, pair[0] = buf[j], pair[1] = pts[i];
+		buf[m++] = pts[i];
+	}
+	return best;
+}
+static double closest_pair(Point* pts, int n, Point pair[2]) {
+	assert(pts!=NULL&&pair!=NULL);
+	Point* buf;
+	double best = -1.0;
+	if (n < 2)
+		return HUGE_VAL;
+	if ((buf = malloc(n * sizeof(*buf))) != NULL && point_sort(pts, n) == 0)
+		best = closest_rec(pts, n, buf, HUGE_VAL, pair);
+	free(buf);
+	return best;
+}
+
 #endif
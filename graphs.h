@@ -24,23 +24,117 @@
  */
 typedef struct Graph_edge { struct Graph_edge* next; int dst, cost; } Graph_edge;
 typedef struct Graph_node { Graph_edge* first; struct Graph_node* prev; int total; } Graph_node;
-static int Graph_ncomp(const void* a, const void* b) { return (((Graph_node*)a)->total > ((Graph_node*)b)->total); }
+#define Graph_nless(base, i, j) ((base)[i].total < (base)[j].total)
+HEAP_INDEXED(Graph_nheap, const Graph_node*, Graph_nless)
 static int Graph_Dijkstra(Graph_node* base, int n, int start, int end) {
-	assert(base!=NULL&&n>=0&&(unsigned int)start<n&&(unsigned int)end<n);
-	int heap[n], pos[n], i, s, t;
+	assert(base!=NULL&&n>=0&&start>=0&&start<n&&end<n);
+	int *heap = malloc(2 * n * sizeof(*heap)), *pos = heap + n, i = start, s, t;
 	Graph_edge* e;
-	memset(pos, -1, sizeof(pos));
+	assert(heap!=NULL);
+	memset(pos, -1, n * sizeof(*pos));
 	base[start].prev = base + start;
-	s = Heap_ins(heap, pos, base, sizeof(*base), Graph_ncomp, 0, start);
-	while (s > 0 && (i = Heap_get(heap, pos, base, sizeof(*base), Graph_ncomp, --s)) != end) {
+	s = Graph_nheap_push(heap, pos, base, 0, start);
+	while (s > 0 && (i = Graph_nheap_pop(heap, pos, base, --s)) != end) {
 		for (e = base[i].first, t = base[i].total; e != NULL; e = e->next) {
 			if (base[e->dst].prev == NULL || base[e->dst].total > t + e->cost) {
 				base[e->dst].total = t + e->cost;
 				base[e->dst].prev = base + i;
-				s = Heap_ins(heap, pos, base, sizeof(*base), Graph_ncomp, s, e->dst);
+				s = Graph_nheap_push(heap, pos, base, s, e->dst);
 			}
 		}
 	}
+	free(heap);
+	return i;
+}
+
+
+
+/**
+ * Find the shortest paths from a single node in a directed graph stored in
+ * compressed rows. O(e*log n), or O(e+n*C) with Graph_Dial for costs in [0, C]
+ *
+ * _ Convert a Graph_node array with the edges set (0 on success):
+ *   Graph_csr g; Graph_init_csr(&g, base, n);
+ * _ Compute the shortest paths from start to end, returning the last node
+ *   processed (like Graph_Dijkstra): int dist[n], prev[n];
+ *   int last = Graph_csr_Dijkstra(&g, start, end, dist, prev);
+ * _ For each node, prev stores the predecessor (or -1 if it is unreachable).
+ * _ Release the arrays when done: Graph_free_csr(&g);
+ */
+typedef struct { int dst, cost; } Graph_arc;
+typedef struct { int n, *first; Graph_arc* arcs; } Graph_csr;
+static int Graph_init_csr(Graph_csr* g, const Graph_node* base, int n) {
+	assert(g!=NULL&&base!=NULL&&n>=0);
+	const Graph_edge* e;
+	int i, a;
+	g->n = n, g->arcs = NULL;
+	if ((g->first = malloc((n + 1) * sizeof(*g->first))) == NULL)
+		return -1;
+	for (i = a = 0; i < n; i++)
+		for (g->first[i] = a, e = base[i].first; e != NULL; e = e->next, a++);
+	g->first[n] = a;
+	if ((g->arcs = malloc(a * sizeof(*g->arcs) + 1)) == NULL)
+		return free(g->first), g->first = NULL, -1;
+	for (i = a = 0; i < n; i++) {
+		for (e = base[i].first; e != NULL; e = e->next, a++)
+			g->arcs[a].dst = e->dst, g->arcs[a].cost = e->cost;
+	}
+	return 0;
+}
+static void Graph_free_csr(Graph_csr* g) { free(g->first), free(g->arcs), g->first = NULL, g->arcs = NULL; }
+#define Graph_dless(dist, i, j) ((dist)[i] < (dist)[j])
+HEAP_INDEXED(Graph_dheap, const int*, Graph_dless)
+static int Graph_csr_Dijkstra(const Graph_csr* g, int start, int end, int* dist, int* prev) {
+	assert(g!=NULL&&dist!=NULL&&prev!=NULL&&start>=0&&start<g->n&&end<g->n);
+	int *heap = malloc(2 * g->n * sizeof(*heap)), *pos = heap + g->n, s = 1, i = start, j;
+	const Graph_arc *a, *l;
+	assert(heap!=NULL);
+	memset(prev, -1, g->n * sizeof(*prev));
+	memset(pos, -1, g->n * sizeof(*pos));
+	dist[start] = 0, prev[start] = start, heap[0] = start, pos[start] = 0;
+	while (s > 0 && (i = Graph_dheap_pop(heap, pos, dist, --s)) != end) {
+		for (a = g->arcs + g->first[i], l = g->arcs + g->first[i + 1]; a < l; a++) {
+			if (prev[j = a->dst] < 0 || dist[j] > dist[i] + a->cost)
+				dist[j] = dist[i] + a->cost, prev[j] = i, s = Graph_dheap_push(heap, pos, dist, s, j);
+		}
+	}
+	free(heap);
+	return i;
+}
+static int Graph_Dial(const Graph_csr* g, int C, int start, int end, int* dist, int* prev) {
+	assert(g!=NULL&&dist!=NULL&&prev!=NULL&&C>=0&&start>=0&&start<g->n&&end<g->n);
+	int *head = malloc((2 * g->n + C + 1) * sizeof(*head)), *next = head + C + 1, *back = next + g->n;
+	int num = 1, cur = 0, b, i = start, j;
+	const Graph_arc *a, *l;
+	assert(head!=NULL);
+	memset(head, -1, (C + 1) * sizeof(*head));
+	memset(prev, -1, g->n * sizeof(*prev));
+	dist[start] = 0, prev[start] = start, head[0] = start, next[start] = back[start] = -1;
+	for (; num > 0; num--) {
+		while (head[b = cur % (C + 1)] < 0)
+			cur++;
+		if ((i = head[b]) == end)
+			break;
+		if ((head[b] = next[i]) >= 0)
+			back[next[i]] = -1;
+		for (a = g->arcs + g->first[i], l = g->arcs + g->first[i + 1]; a < l; a++) {
+			if (prev[j = a->dst] >= 0 && dist[j] <= cur + a->cost)
+				continue;
+			if (prev[j] < 0)
+				num++;
+			else if (back[j] >= 0)
+				next[back[j]] = next[j];
+			else
+				head[dist[j] % (C + 1)] = next[j];
+			if (prev[j] >= 0 && next[j] >= 0)
+				back[next[j]] = back[j];
+			dist[j] = cur + a->cost, prev[j] = i, b = dist[j] % (C + 1);
+			next[j] = head[b], back[j] = -1, head[b] = j;
+			if (next[j] >= 0)
+				back[next[j]] = j;
+		}
+	}
+	free(head);
 	return i;
 }
 
@@ -48,32 +142,70 @@ static int Graph_Dijkstra(Graph_node* base, int n, int start, int end) {
 
 /**
  * Find the shortest paths from a single node in a directed graph with possibly
- * negative edge weights. O(n*e)
+ * negative edge weights, using a queue with small-label-first insertion. O(n*e)
  *
  * _ Begin with a zero-initialised array with the edges set: Graph_node bf[n];
  * _ Compute the shortest paths from start, returning 0 if no negative-weight
  *   cycle was found: int cyclic = Graph_Bellman_Ford(bf, n, start);
  * _ For each node, total equals INT_MIN if it crosses a negative-weight cycle.
+ *   A cycle is caught when the predecessors form a loop (checked every n
+ *   updates) or some path reaches n edges, and everything reachable from it is
+ *   marked without further relaxations.
+ * _ On compressed rows, the nodes of each frontier are relaxed in parallel
+ *   with -fopenmp, by an atomic min on the distance and predecessor packed in
+ *   64 bits, with the same check for loops:
+ *   int cyclic = Graph_csr_Bellman_Ford(&g, start, dist, prev);
+ *   (dist is INT_MIN behind a negative cycle, INT_MAX with prev -1 if unreachable)
  */
+static void Graph_mark_inf(Graph_node* base, int* stack, int i) {
+	Graph_edge* e;
+	int s = 1;
+	for (*stack = i, base[i].total = INT_MIN; s > 0;) {
+		for (e = base[i = stack[--s]].first; e != NULL; e = e->next) {
+			if (base[e->dst].total != INT_MIN)
+				base[e->dst].total = INT_MIN, base[e->dst].prev = base + i, stack[s++] = e->dst;
+		}
+	}
+}
+static int Graph_cycles(Graph_node* base, int n, int* seen, int* stack) {
+	int i, j, k, cyclic = 0;
+	memset(seen, -1, n * sizeof(*seen));
+	for (i = 0; i < n; i++) { /* Walk up the predecessors, a loop being a negative cycle. */
+		for (j = i, k = 0; k >= 0 && seen[j] < 0; j = (k >= 0) ? k : j) {
+			seen[j] = i, k = (base[j].prev == NULL) ? -1 : base[j].prev - base;
+			k = (base[j].total == INT_MIN || k == j) ? -1 : k;
+		}
+		if (k >= 0 && seen[j] == i)
+			Graph_mark_inf(base, stack, j), cyclic = 1;
+	}
+	return cyclic;
+}
 static int Graph_Bellman_Ford(Graph_node* base, int n, int start) {
-	assert(base!=NULL&&n>=0&&(unsigned int)start<n);
-	int stack[2][n], pos[n], *r = stack[0], *w = stack[1], *p, c = 0, i, j, k, l = 1, t;
+	assert(base!=NULL&&n>=0&&start>=0&&start<n);
+	int *queue = malloc(5 * n * sizeof(*queue)), *len = queue + n, *in = len + n, *stack = in + n, *seen = stack + n;
+	int head = 0, num = 1, cyclic = 0, since = 0, i, j, t;
 	Graph_edge* e;
-	for (base[*r = start].prev = &base[start]; l > 0 && c < n; p = r, r = w, w = p, c++, l = k) {
-		for (memset(pos, -1, sizeof(pos)), j = k = 0; j < l; j++) {
-			for (i = r[j], t = base[i].total, e = base[i].first; e != NULL; e = e->next) {
-				if (base[e->dst].prev == NULL || base[e->dst].total > t + e->cost) {
-					base[e->dst].total = t + e->cost;
-					base[e->dst].prev = base + i;
-					if (pos[e->dst] < 0)
-						pos[e->dst] = k, w[k++] = e->dst;
-				}
-			}
+	assert(queue!=NULL);
+	memset(in, 0, n * sizeof(*in));
+	base[*queue = start].prev = base + start, len[start] = 0, in[start] = 1;
+	while (num-- > 0) {
+		i = queue[head], head = (head + 1) % n, in[i] = 0;
+		for (e = base[i].first, t = base[i].total; t != INT_MIN && e != NULL; e = e->next) {
+			if (base[j = e->dst].total == INT_MIN || (base[j].prev != NULL && base[j].total <= t + e->cost))
+				continue;
+			base[j].total = t + e->cost, base[j].prev = base + i;
+			if ((len[j] = len[i] + 1) >= n)
+				Graph_mark_inf(base, stack, j), cyclic = 1;
+			else if (in[j] == 0 && num > 0 && base[j].total < base[queue[head]].total)
+				head = (head + n - 1) % n, queue[head] = j, in[j] = 1, num++;
+			else if (in[j] == 0)
+				queue[(head + num++) % n] = j, in[j] = 1;
+			if (++since >= n && (since = 0, Graph_cycles(base, n, seen, stack))) /* Amortized O(1) per update. */
+				cyclic = 1, t = base[i].total;
 		}
 	}
-	for (j = 0; j < l; j++)
-		base[r[j]].total = INT_MIN;
-	return l;
+	free(queue);
+	return cyclic;
 }
 static int Graph_inf_path(Graph_node* base, int start, int end) {
 	assert(base!=NULL&&start>=0&&end>=0);
@@ -84,6 +216,73 @@ static int Graph_inf_path(Graph_node* base, int start, int end) {
 	} while (start != end);
 	return 0;
 }
+#define Graph_key(dist, prev) ((long long)(dist) * 4294967296LL + (unsigned int)(prev))
+#define Graph_key_dist(key) ((int)((key) >> 32))
+static void Graph_csr_mark_inf(const Graph_csr* g, long long* best, int* stack, int i) {
+	const Graph_arc *a, *l;
+	int s = 1;
+	for (*stack = i, best[i] = Graph_key(INT_MIN, best[i]); s > 0;) {
+		for (i = stack[--s], a = g->arcs + g->first[i], l = g->arcs + g->first[i + 1]; a < l; a++) {
+			if (Graph_key_dist(best[a->dst]) != INT_MIN)
+				best[a->dst] = Graph_key(INT_MIN, i), stack[s++] = a->dst;
+		}
+	}
+}
+static int Graph_csr_cycles(const Graph_csr* g, long long* best, int* seen, int* stack) {
+	int i, j, k, d, cyclic = 0;
+	memset(seen, -1, g->n * sizeof(*seen));
+	for (i = 0; i < g->n; i++) { /* Walk up the predecessors, a loop being a negative cycle. */
+		for (j = i, k = 0; k >= 0 && seen[j] < 0; j = (k >= 0) ? k : j) {
+			seen[j] = i, d = Graph_key_dist(best[j]), k = (int)(unsigned int)best[j];
+			k = (d == INT_MAX || d == INT_MIN || k == j) ? -1 : k;
+		}
+		if (k >= 0 && seen[j] == i)
+			Graph_csr_mark_inf(g, best, stack, j), cyclic = 1;
+	}
+	return cyclic;
+}
+static int Graph_csr_Bellman_Ford(const Graph_csr* g, int start, int* dist, int* prev) {
+	assert(g!=NULL&&dist!=NULL&&prev!=NULL&&start>=0&&start<g->n);
+	long long *best = malloc(g->n * sizeof(*best));
+	int *cur = malloc(5 * g->n * sizeof(*cur)), *next = cur + g->n, *when = next + g->n, *seen = when + g->n, *stack = seen + g->n;
+	int num = 1, round, since = 0, cyclic = 0, i, k, *p = cur, *q;
+	assert(best!=NULL&&cur!=NULL);
+	for (i = 0; i < g->n; i++)
+		best[i] = Graph_key(INT_MAX, -1), when[i] = -1;
+	best[start] = Graph_key(0, start), *cur = start;
+	for (round = 0; num > 0; round++, q = cur, cur = next, next = q) {
+		int added = 0;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(dynamic, 64)
+		#endif
+		for (k = 0; k < num; k++) {
+			const Graph_arc *a, *l;
+			long long old, nd;
+			int u = cur[k], du = Graph_key_dist(__atomic_load_n(best + u, __ATOMIC_RELAXED));
+			for (a = g->arcs + g->first[u], l = g->arcs + g->first[u + 1]; du != INT_MIN && a < l; a++) {
+				nd = (long long)du + a->cost, nd = (nd <= INT_MIN) ? INT_MIN + 1 : nd;
+				for (old = __atomic_load_n(best + a->dst, __ATOMIC_RELAXED); Graph_key_dist(old) > nd; ) { /* Atomic min on the distance. */
+					if (__atomic_compare_exchange_n(best + a->dst, &old, Graph_key(nd, u), 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+						if (__atomic_exchange_n(when + a->dst, round, __ATOMIC_RELAXED) != round)
+							next[__atomic_fetch_add(&added, 1, __ATOMIC_RELAXED)] = a->dst;
+						break;
+					}
+				}
+			}
+		}
+		num = added;
+		if ((since += num) >= g->n || round >= g->n) { /* Amortized O(1) per update. */
+			cyclic |= Graph_csr_cycles(g, best, seen, stack), since = 0;
+			for (i = 0; round >= g->n && i < num; i++) /* Still improving after n rounds, so behind a cycle. */
+				if (Graph_key_dist(best[next[i]]) != INT_MIN)
+					Graph_csr_mark_inf(g, best, stack, next[i]), cyclic = 1;
+		}
+	}
+	for (i = 0; i < g->n; i++)
+		dist[i] = Graph_key_dist(best[i]), prev[i] = (int)(unsigned int)best[i];
+	free(best), free(p);
+	return cyclic;
+}
 
 
 
@@ -117,12 +316,107 @@ static void Graph_Floyd_Warshall(Graph_dense* base, int n) {
 		}
 	}
 }
-static int Graph_inf_dense_path(Graph_dense* base, int n, int i, int j) {
+static int Graph_inf_matrix_path(const int* cost, size_t stride, int n, int i, int j) {
 	int k, inf;
 	for (inf = k = 0; inf == 0 && k < n; k++)
-		inf = (base[k*n+k].cost < 0 && base[i*n+k].cost != INT_MAX && base[k*n+j].cost != INT_MAX);
+		inf = (cost[((size_t)k*n+k)*stride] < 0 && cost[((size_t)i*n+k)*stride] != INT_MAX && cost[((size_t)k*n+j)*stride] != INT_MAX);
 	return inf;
 }
+static int Graph_inf_dense_path(Graph_dense* base, int n, int i, int j) { return Graph_inf_matrix_path(&base->cost, sizeof(*base) / sizeof(int), n, i, j); }
+
+
+
+/**
+ * Same as above with separate cost/next matrices, processed in square tiles
+ * that fit in L1 (the inner loop vectorizes, and -fopenmp spreads the tiles of
+ * each phase across cores). O(n)
+ *
+ * _ Begin with two square arrays: int cost[n*n], next[n*n];
+ * _ Initialize them before setting the costs: Graph_init_blocked(cost, next, n);
+ * _ Compute the shortest paths: Graph_Floyd_Warshall_blocked(cost, next, n);
+ * _ next stores an intermediary node (or -1 for a direct edge), and negative
+ *   cycles are detected with: Graph_inf_blocked_path(cost, n, i, j);
+ */
+enum { GRAPH_TILE = 64 };
+static void Graph_init_blocked(int* cost, int* next, int n) {
+	assert(cost!=NULL&&next!=NULL);
+	int i, j;
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n; j++)
+			cost[(size_t)i*n+j] = (i == j) ? 0 : INT_MAX, next[(size_t)i*n+j] = -1;
+	}
+}
+static void Graph_tile(int* cost, int* next, int n, int i0, int j0, int k0) {
+	int i, j, k, c, il = min(i0 + GRAPH_TILE, n), jl = min(j0 + GRAPH_TILE, n), kl = min(k0 + GRAPH_TILE, n);
+	for (k = k0; k < kl; k++) {
+		for (i = i0; i < il; i++) {
+			int *ci = cost + (size_t)i*n, *ni = next + (size_t)i*n;
+			const int *ck = cost + (size_t)k*n;
+			if ((c = ci[k]) == INT_MAX)
+				continue;
+			#pragma omp simd
+			for (j = j0; j < jl; j++) {
+				int d = (ck[j] == INT_MAX) ? INT_MAX : c + ck[j];
+				ni[j] = (d < ci[j]) ? k : ni[j];
+				ci[j] = (d < ci[j]) ? d : ci[j];
+			}
+		}
+	}
+}
+static void Graph_Floyd_Warshall_blocked(int* cost, int* next, int n) {
+	assert(cost!=NULL&&next!=NULL&&n>=0);
+	int k, i, j;
+	for (k = 0; k < n; k += GRAPH_TILE) {
+		Graph_tile(cost, next, n, k, k, k);
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(dynamic)
+		#endif
+		for (i = 0; i < n; i += GRAPH_TILE) {
+			if (i != k)
+				Graph_tile(cost, next, n, k, i, k), Graph_tile(cost, next, n, i, k, k);
+		}
+		#ifdef _OPENMP
+		#pragma omp parallel for private(j) schedule(dynamic)
+		#endif
+		for (i = 0; i < n; i += GRAPH_TILE) {
+			for (j = 0; j < n && i != k; j += GRAPH_TILE) {
+				if (j != k)
+					Graph_tile(cost, next, n, i, j, k);
+			}
+		}
+	}
+}
+static int Graph_inf_blocked_path(const int* cost, int n, int i, int j) { return Graph_inf_matrix_path(cost, 1, n, i, j); }
+
+
+
+/**
+ * Transitive closure of a directed graph, with one row of bits per node and
+ * the rows of each step updated in parallel with -fopenmp. O(n/64)
+ *
+ * _ Begin with the edges set, and n zeroed bitsets of n bits:
+ *   Graph_node tc[n]; Bits reach[n]; (Bits_init(&reach[i], n) for each i)
+ * _ Compute the closure: Graph_closure(tc, n, reach);
+ * _ Bits_test(&reach[i], j) is 1 if there is a path of 1 or more edges i -> j.
+ */
+static void Graph_closure(const Graph_node* base, int n, Bits* reach) {
+	assert(base!=NULL&&n>=0&&reach!=NULL);
+	const Graph_edge* e;
+	int i, k;
+	for (i = 0; i < n; i++) {
+		for (e = base[i].first; e != NULL; e = e->next)
+			Bits_set(reach + i, e->dst);
+	}
+	for (k = 0; k < n; k++) {
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+		for (i = 0; i < n; i++) {
+			if (i != k && Bits_test(reach + i, k)) /* Row k is read by all, so not rewritten. */
+				Bits_or(reach + i, reach + k);
+		}
+	}
+}
 
 
 
@@ -135,7 +429,7 @@ static int Graph_inf_dense_path(Graph_dense* base, int n, int i, int j) {
  *   int cost = Graph_Kruskal(mst, e, forest, n);
  */
 typedef struct { int cost, node1, node2; } Graph_biedge;
-static int Graph_bcomp(const void* a, const void* b) { return ((Graph_biedge*)a)->cost - ((Graph_biedge*)b)->cost; }
+static int Graph_bcomp(const void* a, const void* b) { return (((Graph_biedge*)a)->cost > ((Graph_biedge*)b)->cost) - (((Graph_biedge*)a)->cost < ((Graph_biedge*)b)->cost); }
 static int Graph_Kruskal(Graph_biedge* base, int e, int* forest, int n) {
 	assert(base!=NULL&&e>=0&&forest!=NULL&&n>=0);
 	int i, j, c;
@@ -148,4 +442,273 @@ static int Graph_Kruskal(Graph_biedge* base, int e, int* forest, int n) {
 	return c;
 }
 
+
+
+/**
+ * Same as above, sorting the edges by cost with a radix sort. O(e+n*log n)
+ * Or merging every component along its cheapest edge at each round, which
+ * scans the edges in parallel when compiled with -fopenmp. O(e*log n)
+ *
+ * _ Both return the same cost and forest as Graph_Kruskal, with the edges of
+ *   the mst moved to the front of base:
+ *   int cost = Graph_Kruskal_radix(mst, e, forest, n);
+ *   int cost = Graph_Boruvka(mst, e, forest, n);
+ */
+static int Graph_Kruskal_radix(Graph_biedge* base, int e, int* forest, int n) {
+	assert(base!=NULL&&e>=0&&forest!=NULL&&n>=0);
+	Graph_biedge *tmp = malloc(e * sizeof(*tmp) + 1), *src = base, *dst = tmp, *p;
+	int count[4][257] = {{0}}, i, j, c, d;
+	assert(tmp!=NULL);
+	for (i = 0; i < e; i++) {
+		for (d = 0; d < 4; d++)
+			count[d][(((unsigned int)base[i].cost ^ INT_MIN) >> 8 * d & 255) + 1]++;
+	}
+	for (d = 0; d < 4; d++) {
+		if (e == 0 || count[d][(((unsigned int)base[0].cost ^ INT_MIN) >> 8 * d & 255) + 1] == e)
+			continue;
+		for (j = 1; j < 256; j++)
+			count[d][j] += count[d][j - 1];
+		for (i = 0; i < e; i++)
+			dst[count[d][((unsigned int)src[i].cost ^ INT_MIN) >> 8 * d & 255]++] = src[i];
+		p = src, src = dst, dst = p;
+	}
+	if (src != base)
+		memcpy(base, src, e * sizeof(*base));
+	free(tmp);
+	memset(forest, -1, sizeof(*forest) * n);
+	for (i = c = j = 0; i < e; i++) {
+		if (Set_test(forest, base[i].node1, base[i].node2) == 0)
+			Set_union(forest, base[i].node1, base[i].node2), c += base[i].cost, base[j++] = base[i];
+	}
+	return c;
+}
+static int Graph_Boruvka(Graph_biedge* base, int e, int* forest, int n) {
+	assert(base!=NULL&&e>=0&&forest!=NULL&&n>=0);
+	long long *best = malloc(n * sizeof(*best) + 1), k, old;
+	int *comp = malloc(n * sizeof(*comp) + 1), i, j, c = 0, merged = 1, a, b;
+	char *used = calloc(e + 1, 1);
+	assert(best!=NULL&&comp!=NULL&&used!=NULL);
+	memset(forest, -1, sizeof(*forest) * n);
+	while (merged) {
+		for (i = merged = 0; i < n; i++)
+			comp[i] = Set_find(forest, i), best[i] = LLONG_MAX;
+		#ifdef _OPENMP
+		#pragma omp parallel for private(a, b, k, old)
+		#endif
+		for (i = 0; i < e; i++) {
+			if ((a = comp[base[i].node1]) == (b = comp[base[i].node2]))
+				continue;
+			k = base[i].cost * (1LL << 32) + i;
+			for (old = __atomic_load_n(best + a, __ATOMIC_RELAXED); k < old && !__atomic_compare_exchange_n(best + a, &old, k, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED););
+			for (old = __atomic_load_n(best + b, __ATOMIC_RELAXED); k < old && !__atomic_compare_exchange_n(best + b, &old, k, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED););
+		}
+		for (i = 0; i < n; i++) {
+			if (comp[i] != i || best[i] == LLONG_MAX)
+				continue;
+			j = best[i] & 0xffffffff;
+			if (Set_test(forest, base[j].node1, base[j].node2) == 0)
+				Set_union(forest, base[j].node1, base[j].node2), c += base[j].cost, used[j] = merged = 1;
+		}
+	}
+	for (i = j = 0; i < e; i++) {
+		if (used[i])
+			base[j++] = base[i];
+	}
+	free(best), free(comp), free(used);
+	return c;
+}
+
+
+
+/**
+ * Find a maximum flow in a directed graph, stored as pairs of edges where edge
+ * 2k goes along edge k and 2k+1 is its residual, listed per node in compressed
+ * rows. Dinic with current arcs, O(n*e), or highest-label push-relabel with
+ * gap and global relabeling, O(n*sqrt(e)).
+ *
+ * _ Allocate a graph for up to m edges (0 on success): Graph_flow g; Graph_init_flow(&g, n, m);
+ * _ Add each edge, returning its index k: Graph_add_flow(&g, u, v, cap);
+ * _ Compute the maximal flow from s to t (once per graph):
+ *   long long f = Graph_Dinic(&g, s, t); or Graph_push_relabel(&g, s, t);
+ * _ The flow on edge k is then g.cap[2 * k + 1].
+ * _ Release the arrays when done: Graph_free_flow(&g);
+ */
+typedef struct { int n, m, size, *first, *adj, *dst; long long* cap; } Graph_flow;
+static void Graph_free_flow(Graph_flow* g) {
+	free(g->first), free(g->adj), free(g->dst), free(g->cap);
+	g->first = g->adj = g->dst = NULL, g->cap = NULL;
+}
+static int Graph_init_flow(Graph_flow* g, int n, int size) {
+	assert(g!=NULL&&n>0&&size>=0);
+	g->n = n, g->m = 0, g->size = size;
+	g->first = malloc((n + 2) * sizeof(int)), g->adj = malloc(2 * (size_t)size * sizeof(int) + 1);
+	g->dst = malloc(2 * (size_t)size * sizeof(int) + 1), g->cap = malloc(2 * (size_t)size * sizeof(long long) + 1);
+	if (g->first == NULL || g->adj == NULL || g->dst == NULL || g->cap == NULL) {
+		Graph_free_flow(g);
+		return -1;
+	}
+	return 0;
+}
+static int Graph_add_flow(Graph_flow* g, int u, int v, long long cap) {
+	assert(g!=NULL&&g->m<g->size&&u>=0&&u<g->n&&v>=0&&v<g->n&&cap>=0);
+	g->dst[2 * g->m] = v, g->cap[2 * g->m] = cap;
+	g->dst[2 * g->m + 1] = u, g->cap[2 * g->m + 1] = 0;
+	return g->m++;
+}
+static void Graph_flow_rows(Graph_flow* g) {
+	int i, e;
+	memset(g->first, 0, (g->n + 2) * sizeof(int));
+	for (e = 0; e < 2 * g->m; e++)
+		g->first[g->dst[e ^ 1] + 2]++;
+	for (i = 0; i < g->n; i++)
+		g->first[i + 2] += g->first[i + 1];
+	for (e = 0; e < 2 * g->m; e++)
+		g->adj[g->first[g->dst[e ^ 1] + 1]++] = e;
+}
+static int Graph_flow_levels(const Graph_flow* g, int s, int t, int* level, int* queue) {
+	int head = 0, tail = 0, u, i, e;
+	for (i = 0; i < g->n; i++)
+		level[i] = -1;
+	for (level[t] = 0, queue[tail++] = t; head < tail && level[s] < 0; ) { /* Distances to t. */
+		for (u = queue[head++], i = g->first[u]; i < g->first[u + 1]; i++) {
+			e = g->adj[i];
+			if (g->cap[e ^ 1] > 0 && level[g->dst[e]] < 0)
+				level[g->dst[e]] = level[u] + 1, queue[tail++] = g->dst[e];
+		}
+	}
+	return level[s] >= 0;
+}
+static long long Graph_Dinic(Graph_flow* g, int s, int t) {
+	assert(g!=NULL&&s>=0&&s<g->n&&t>=0&&t<g->n&&s!=t);
+	int *level = malloc(4 * (size_t)g->n * sizeof(int)), *cur = level + g->n, *path = cur + g->n, *queue = path + g->n;
+	int u, v, e, k, len, cut;
+	long long flow = 0, f;
+	assert(level!=NULL);
+	Graph_flow_rows(g);
+	while (Graph_flow_levels(g, s, t, level, queue)) {
+		memcpy(cur, g->first, g->n * sizeof(int));
+		for (u = s, len = 0; ; ) {
+			if (u == t) { /* Augment along the path, and go back before its first saturated edge. */
+				for (f = g->cap[path[0]], k = 1; k < len; k++)
+					f = (g->cap[path[k]] < f) ? g->cap[path[k]] : f;
+				for (cut = -1, k = 0; k < len; k++) {
+					g->cap[path[k]] -= f, g->cap[path[k] ^ 1] += f;
+					if (cut < 0 && g->cap[path[k]] == 0)
+						cut = k;
+				}
+				flow += f, len = cut, u = g->dst[path[cut] ^ 1];
+				continue;
+			}
+			for (; cur[u] < g->first[u + 1]; cur[u]++) {
+				e = g->adj[cur[u]], v = g->dst[e];
+				if (g->cap[e] > 0 && level[v] == level[u] - 1)
+					break;
+			}
+			if (cur[u] < g->first[u + 1]) {
+				path[len++] = g->adj[cur[u]], u = g->dst[g->adj[cur[u]]];
+			} else { /* Dead end, removed from the level graph. */
+				level[u] = -1;
+				if (len == 0)
+					break;
+				u = g->dst[path[--len] ^ 1], cur[u]++;
+			}
+		}
+	}
+	free(level);
+	return flow;
+}
+static void Graph_global_relabel(const Graph_flow* g, int s, int t, int* label, int* queue) {
+	int head, tail, u, v, i, e, r;
+	for (i = 0; i < g->n; i++)
+		label[i] = 2 * g->n;
+	for (r = 0; r < 2; r++) { /* Distances to t, then n + distances to s for the others. */
+		head = tail = 0, queue[tail++] = (r == 0) ? t : s;
+		label[queue[0]] = (r == 0) ? 0 : g->n;
+		while (head < tail) {
+			for (u = queue[head++], i = g->first[u]; i < g->first[u + 1]; i++) {
+				e = g->adj[i], v = g->dst[e];
+				if (g->cap[e ^ 1] > 0 && label[v] == 2 * g->n && v != s)
+					label[v] = label[u] + 1, queue[tail++] = v;
+			}
+		}
+	}
+}
+static long long Graph_push_relabel(Graph_flow* g, int s, int t) {
+	assert(g!=NULL&&s>=0&&s<g->n&&t>=0&&t<g->n&&s!=t);
+	const int n = g->n;
+	long long *excess = calloc(n, sizeof(*excess)), f;
+	int *label = malloc(7 * (size_t)n * sizeof(int)), *cur = label + n, *count = cur + n, *next = count + 2 * n, *top = next + n;
+	int *queue = malloc(n * sizeof(int)), high = 0, u, v, e, i, h, work = 0;
+	assert(excess!=NULL&&label!=NULL&&queue!=NULL);
+	Graph_flow_rows(g);
+	for (i = g->first[s]; i < g->first[s + 1]; i++) { /* Saturate the edges out of s. */
+		e = g->adj[i], f = g->cap[e];
+		g->cap[e] -= f, g->cap[e ^ 1] += f, excess[g->dst[e]] += f, excess[s] -= f;
+	}
+	for (;;) {
+		if (work >= 0) { /* Relabel everything from distances, and rebuild the buckets. */
+			Graph_global_relabel(g, s, t, label, queue);
+			memset(count, 0, 2 * n * sizeof(int));
+			for (i = 0; i < 2 * n; i++)
+				top[i] = -1;
+			for (high = 0, i = 0; i < n; i++) {
+				cur[i] = g->first[i];
+				if (label[i] < 2 * n)
+					count[label[i]]++;
+				if (i != s && i != t && excess[i] > 0 && label[i] < 2 * n) {
+					next[i] = top[label[i]], top[label[i]] = i;
+					high = (label[i] > high) ? label[i] : high;
+				}
+			}
+			work = -6 * n - g->m;
+		}
+		while (high >= 0 && top[high] < 0)
+			high--;
+		if (high < 0)
+			break;
+		u = top[high], top[high] = next[u]; /* Its label may have risen with a gap. */
+		while (excess[u] > 0 && label[u] < 2 * n) { /* Discharge u. */
+			if (cur[u] == g->first[u + 1]) {
+				h = label[u], work += g->first[u + 1] - g->first[u] + 12;
+				for (label[u] = 2 * n, i = g->first[u]; i < g->first[u + 1]; i++) {
+					e = g->adj[i];
+					if (g->cap[e] > 0 && label[g->dst[e]] + 1 < label[u])
+						label[u] = label[g->dst[e]] + 1, cur[u] = i;
+				}
+				count[h]--;
+				if (label[u] < 2 * n)
+					count[label[u]]++;
+				if (count[h] == 0 && h < n) { /* Gap: nothing above h can reach t. */
+					for (i = 0; i < n; i++) {
+						if (label[i] > h && label[i] < n) {
+							count[label[i]]--, label[i] = n + 1, count[n + 1]++;
+							cur[i] = g->first[i];
+						}
+					}
+				}
+				continue;
+			}
+			e = g->adj[cur[u]], v = g->dst[e];
+			if (g->cap[e] > 0 && label[u] == label[v] + 1) {
+				f = (excess[u] < g->cap[e]) ? excess[u] : g->cap[e];
+				g->cap[e] -= f, g->cap[e ^ 1] += f, excess[u] -= f;
+				if (excess[v] == 0 && v != s && v != t) {
+					next[v] = top[label[v]], top[label[v]] = v;
+					high = (label[v] > high) ? label[v] : high;
+				}
+				excess[v] += f;
+			} else {
+				cur[u]++;
+			}
+		}
+		if (excess[u] > 0 && label[u] < 2 * n) {
+			next[u] = top[label[u]], top[label[u]] = u;
+			high = (label[u] > high) ? label[u] : high;
+		}
+	}
+	f = excess[t];
+	free(excess), free(label), free(queue);
+	return f;
+}
+
 #endif
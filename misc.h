@@ -6,9 +6,13 @@
 #define MISC_H
 
 #include <assert.h>
+#include <errno.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #define SWAP(a, b) do { typeof(a) t = a; a = b; b = t; } while(0)
 static inline long long min(long long a, long long b) { return (a < b) ? a : b; }
@@ -18,16 +22,94 @@ static inline unsigned long long umax(unsigned long long a, unsigned long long b
 
 
 
-/* Custom bitset implementation (replace 100 below with the desired size). */
-enum { BITS_CHUNKS = (100 + LONG_BIT - 1) / LONG_BIT };
-typedef struct { unsigned long d[BITS_CHUNKS]; } Bits;
-static void Bits_set(Bits* b, unsigned int i) { b->d[i / LONG_BIT] |= 1 << i % LONG_BIT; }
-static void Bits_reset(Bits* b, unsigned int i) { b->d[i / LONG_BIT] &= ~(1 << i % LONG_BIT); }
-static void Bits_flip(Bits* b, unsigned int i) { b->d[i / LONG_BIT] ^= 1 << i % LONG_BIT; }
-static int  Bits_test(Bits* b, unsigned int i) { return (b->d[i / LONG_BIT] >> i % LONG_BIT) & 1; }
-static void Bits_or(Bits* dst, const Bits* src) { int c; for (c = 0; c < BITS_CHUNKS; c++) dst->d[c] |= src->d[c]; }
-static void Bits_and(Bits* dst, const Bits* src) { int c; for (c = 0; c < BITS_CHUNKS; c++) dst->d[c] &= src->d[c]; }
-static int  Bits_count(const Bits* b) { int c, v; for (c = v = 0; c < BITS_CHUNKS; c++) v += __builtin_popcountl(b->d[c]); return v; }
+/**
+ * Bitset of any size, on 64-bit words aligned for vector loads. The bulk
+ * operations are plain word loops which the compiler turns into SSE2/AVX2.
+ *
+ * _ Allocate n bits set to zero, returning 0 on success: Bits b; Bits_init(&b, n);
+ * _ Bulk operations between bitsets of the same size (dst may equal src):
+ *   Bits_or(&dst, &src); Bits_and; Bits_xor; Bits_andnot; Bits_count(&b);
+ * _ Find the first set bit from i (or n if none): i = Bits_next(&b, i);
+ * _ Shift towards higher/lower bits: Bits_shl(&b, k); Bits_shr(&b, k);
+ *   Or dst |= src << k in one pass, as in subset sums: Bits_or_shl(&dst, &src, k);
+ * _ After building the prefix counts with Bits_index(&b) (0 on success),
+ *   count the set bits below i with Bits_rank(&b, i) and find the k-th set bit
+ *   (from 0, or n) with Bits_select(&b, k). Rebuild them after modifications.
+ * _ Release the memory when done: Bits_free(&b);
+ */
+typedef struct { size_t n, words; uint64_t* d; size_t* ranks; } Bits;
+static int Bits_init(Bits* b, size_t n) {
+	b->n = n, b->words = (n + 63) / 64, b->ranks = NULL;
+	if ((b->d = aligned_alloc(32, (b->words + 3) / 4 * 32 + 32)) == NULL)
+		return -1;
+	memset(b->d, 0, (b->words + 3) / 4 * 32);
+	return 0;
+}
+static void Bits_free(Bits* b) { free(b->d), free(b->ranks), b->d = NULL, b->ranks = NULL; }
+static void Bits_set(Bits* b, size_t i) { b->d[i / 64] |= 1ULL << i % 64; }
+static void Bits_reset(Bits* b, size_t i) { b->d[i / 64] &= ~(1ULL << i % 64); }
+static void Bits_flip(Bits* b, size_t i) { b->d[i / 64] ^= 1ULL << i % 64; }
+static int  Bits_test(const Bits* b, size_t i) { return (b->d[i / 64] >> i % 64) & 1; }
+static void Bits_or(Bits* dst, const Bits* src) { size_t c; for (c = 0; c < dst->words; c++) dst->d[c] |= src->d[c]; }
+static void Bits_and(Bits* dst, const Bits* src) { size_t c; for (c = 0; c < dst->words; c++) dst->d[c] &= src->d[c]; }
+static void Bits_xor(Bits* dst, const Bits* src) { size_t c; for (c = 0; c < dst->words; c++) dst->d[c] ^= src->d[c]; }
+static void Bits_andnot(Bits* dst, const Bits* src) { size_t c; for (c = 0; c < dst->words; c++) dst->d[c] &= ~src->d[c]; }
+static size_t Bits_count(const Bits* b) { size_t c, v; for (c = v = 0; c < b->words; c++) v += __builtin_popcountll(b->d[c]); return v; }
+static size_t Bits_next(const Bits* b, size_t i) {
+	size_t w = i / 64;
+	uint64_t x;
+	if (i >= b->n)
+		return b->n;
+	for (x = b->d[w] & ~0ULL << i % 64; x == 0; x = b->d[w]) {
+		if (++w >= b->words)
+			return b->n;
+	}
+	return w * 64 + __builtin_ctzll(x);
+}
+static void Bits_or_shl(Bits* dst, const Bits* src, size_t k) {
+	size_t w = k / 64, s = k % 64, c;
+	for (c = dst->words; c-- > w;)
+		dst->d[c] |= src->d[c - w] << s | ((s > 0 && c > w) ? src->d[c - w - 1] >> (64 - s) : 0);
+	if (dst->n % 64 != 0)
+		dst->d[dst->words - 1] &= ~0ULL >> (64 - dst->n % 64);
+}
+static void Bits_shl(Bits* b, size_t k) {
+	size_t w = umin(k / 64, b->words), c;
+	for (c = b->words; c-- > w;)
+		b->d[c] = b->d[c - w] << k % 64 | ((k % 64 > 0 && c > w) ? b->d[c - w - 1] >> (64 - k % 64) : 0);
+	memset(b->d, 0, w * sizeof(*b->d));
+	if (b->n % 64 != 0)
+		b->d[b->words - 1] &= ~0ULL >> (64 - b->n % 64);
+}
+static void Bits_shr(Bits* b, size_t k) {
+	size_t w = umin(k / 64, b->words), c;
+	for (c = 0; c + w < b->words; c++)
+		b->d[c] = b->d[c + w] >> k % 64 | ((k % 64 > 0 && c + w + 1 < b->words) ? b->d[c + w + 1] << (64 - k % 64) : 0);
+	memset(b->d + b->words - w, 0, w * sizeof(*b->d));
+}
+static int Bits_index(Bits* b) {
+	size_t c;
+	free(b->ranks);
+	if ((b->ranks = malloc((b->words + 1) * sizeof(*b->ranks))) == NULL)
+		return -1;
+	for (b->ranks[0] = c = 0; c < b->words; c++)
+		b->ranks[c + 1] = b->ranks[c] + __builtin_popcountll(b->d[c]);
+	return 0;
+}
+static size_t Bits_rank(const Bits* b, size_t i) {
+	return (i >= b->n) ? b->ranks[b->words] : b->ranks[i / 64] + __builtin_popcountll(b->d[i / 64] & ((1ULL << i % 64) - 1));
+}
+static size_t Bits_select(const Bits* b, size_t k) {
+	size_t lo = 0, hi = b->words, mid;
+	uint64_t x;
+	if (k >= b->ranks[b->words])
+		return b->n;
+	while (hi - lo > 1)
+		mid = (lo + hi) / 2, (b->ranks[mid] <= k) ? (lo = mid) : (hi = mid);
+	for (x = b->d[lo], k -= b->ranks[lo]; k > 0; k--)
+		x &= x - 1;
+	return lo * 64 + __builtin_ctzll(x);
+}
 
 
 
@@ -45,13 +127,138 @@ static inline long asciitol(uint8_t **str_p) {
     return (res ^ -negate) + negate;
 }
 
+static const char digit_pairs[201] =
+	"0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+	"5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+static char* utostr(char* str, unsigned long long value) {
+	static const unsigned long long pow10[20] = {0, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+		1000000000, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+		1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL};
+	int d = (64 - __builtin_clzll(value | 1)) * 1233 >> 12; /* Digits from the bit length, off by one at most. */
+	char *end = str + d + 1 - (value < pow10[d]), *p = end;
+	for (; value >= 100; value /= 100)
+		p -= 2, memcpy(p, digit_pairs + value % 100 * 2, 2);
+	str[0] = digit_pairs[value * 2 + (value < 10)]; /* The leading one or two digits, without a branch. */
+	str[value >= 10] = digit_pairs[value * 2 + 1];
+	return end;
+}
 static char* itostr(char* str, int value) {
-	char buf[20], *p = buf;
-	unsigned int div, mod, orig = abs(value);
-	for (*str = '-', str += (value < 0); orig >= 10; orig = div)
-		div = orig / 10, mod = orig % 10, *p++ = '0' + mod;
-	for (*p = '0' + orig; p >= buf; *str++ = *p--);
-	return str;
+	*str = '-';
+	return utostr(str + (value < 0), (value < 0) ? -(unsigned int)value : (unsigned int)value);
+}
+
+
+
+/**
+ * Buffered output to a file descriptor, with numbers formatted two digits at a
+ * time from a table (use it instead of printf for large outputs).
+ *
+ * _ Begin with a writer on stdout: static Writer out = {1};
+ * _ Append a number followed by a separator (none if 0):
+ *   Writer_long(&out, v, '\n'); Writer_double(&out, d, 6, ' ') for 6 decimals.
+ * _ Append an array separated with sep and ending with a newline:
+ *   Writer_ints(&out, a, n, ' '); Writer_longs(&out, a, n, ' ');
+ *   Writer_doubles(&out, a, n, 6, ' ');
+ * _ Arrays are formatted straight into the buffer in runs that fit, with one
+ *   bounds check per run rather than per number.
+ * _ Write out the buffer when done (also done when full), which returns -1 if
+ *   write failed (the buffer is emptied anyway): Writer_flush(&out);
+ * _ Flushing uses write(2), as vmsplice would need the buffer to stay
+ *   untouched until the reader has consumed it.
+ */
+typedef struct { int fd; size_t len; char buf[1 << 16]; } Writer;
+static int Writer_flush(Writer* w) {
+	ssize_t n;
+	char* p = w->buf;
+	while (w->len > 0) {
+		if ((n = write(w->fd, p, w->len)) < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			w->len = 0;
+			return -1;
+		}
+		p += n, w->len -= n;
+	}
+	return 0;
+}
+static char* Writer_fixed(char* p, double d, unsigned long long scale, int decimals) { /* At most 48 chars. */
+	unsigned long long u;
+	char* q;
+	if (!(d < 9e18 / scale && d > -9e18 / scale))
+		return p + snprintf(p, 48, "%.*g", decimals + 1, d);
+	u = ((d < 0) ? -d : d) * scale + 0.5;
+	*p = '-';
+	p = utostr(p + (u > 0 && d < 0), u / scale);
+	if (decimals == 0)
+		return p;
+	for (*p = '.', q = p + 1 + decimals, u %= scale; q - p > 2; u /= 100)
+		q -= 2, memcpy(q, digit_pairs + u % 100 * 2, 2);
+	if (q - p == 2)
+		*--q = '0' + u;
+	return p + 1 + decimals;
+}
+static void Writer_long(Writer* w, long long v, char sep) {
+	char* p;
+	if (w->len + 24 > sizeof(w->buf))
+		Writer_flush(w);
+	p = w->buf + w->len, *p = '-';
+	p = utostr(p + (v < 0), (v < 0) ? -(unsigned long long)v : (unsigned long long)v);
+	*p = sep;
+	w->len = p + (sep != '\0') - w->buf;
+}
+static void Writer_double(Writer* w, double d, int decimals, char sep) {
+	assert(decimals>=0&&decimals<=18);
+	unsigned long long scale = 1;
+	char* p;
+	int i;
+	for (i = 0; i < decimals; i++)
+		scale *= 10;
+	if (w->len + 64 > sizeof(w->buf))
+		Writer_flush(w);
+	p = Writer_fixed(w->buf + w->len, d, scale, decimals);
+	*p = sep;
+	w->len = p + (sep != '\0') - w->buf;
+}
+#define WRITER_ARRAY(name, T, U, width) \
+static void name(Writer* w, const T* a, size_t n, char sep) { \
+	size_t i = 0, run; \
+	char* p; \
+	while (i < n) { \
+		if (w->len + width + 1 > sizeof(w->buf)) \
+			Writer_flush(w); \
+		run = (sizeof(w->buf) - w->len - 1) / width; /* Keeps a byte for the newline. */ \
+		for (run = (run < n - i) ? run : n - i, p = w->buf + w->len; run > 0; run--, i++) { \
+			*p = '-'; \
+			p = utostr(p + (a[i] < 0), (a[i] < 0) ? -(U)a[i] : (U)a[i]); \
+			*p = sep, p += (sep != '\0'); \
+		} \
+		w->len = p - w->buf; \
+	} \
+	if (n > 0) \
+		w->buf[w->len - (sep != '\0')] = '\n', w->len += (sep == '\0'); \
+}
+WRITER_ARRAY(Writer_ints, int, unsigned int, 12)
+WRITER_ARRAY(Writer_longs, long long, unsigned long long, 21)
+static void Writer_doubles(Writer* w, const double* a, size_t n, int decimals, char sep) {
+	assert(decimals>=0&&decimals<=18);
+	unsigned long long scale = 1;
+	size_t i = 0, run;
+	char* p;
+	int k;
+	for (k = 0; k < decimals; k++)
+		scale *= 10;
+	while (i < n) {
+		if (w->len + 50 > sizeof(w->buf))
+			Writer_flush(w);
+		run = (sizeof(w->buf) - w->len - 1) / 49;
+		for (run = (run < n - i) ? run : n - i, p = w->buf + w->len; run > 0; run--, i++) {
+			p = Writer_fixed(p, a[i], scale, decimals);
+			*p = sep, p += (sep != '\0');
+		}
+		w->len = p - w->buf;
+	}
+	if (n > 0)
+		w->buf[w->len - (sep != '\0')] = '\n', w->len += (sep == '\0');
 }
 
 
@@ -74,13 +281,157 @@ static void quicksort(int *first, int *last, int *values)
             lo++;
             hi--;
         }
-        quicksort(lo, last, values + (hi - first));
+        quicksort(lo, last, values + (lo - first));
         last = hi;
     }
 }
+
+
+
+/**
+ * Radix sorts on keys with int values, for any distribution. O(n)
+ *
+ * _ LSD on 8-bit digits of key-min (only those below max-min, and skipping
+ *   those equal for all keys), moving key/value pairs between two temporary
+ *   arrays, returning -1 if they could not be allocated:
+ *   radix_sort(keys, values, num); or radix_sort64 for long long keys.
+ * _ MSD in place (American flag sort), when memory is short:
+ *   flag_sort(keys, values, num);
+ * _ Sample sort for large arrays, cutting them in SAMPLE_BUCKETS ranges from
+ *   sorted samples and spreading the chunks and ranges over the threads with
+ *   -fopenmp, returning -1 if memory ran out: sample_sort(keys, values, num);
+ */
+#define RADIX_DIGIT(U, x, lo, d) ((((U)(x) - (U)(lo)) >> 8 * (d)) & 255)
+#define RADIX_SORT(name, K, U) \
+static int name(K *keys, int *values, size_t num) \
+{ \
+    struct { K key; int value; } *src = malloc(2 * num * sizeof(*src) + 1), *dst = src + num; \
+    size_t count[sizeof(K)][256] = {{0}}, i, d, c, sum; \
+    K lo = (num > 0) ? keys[0] : 0, hi = lo; \
+    if (src == NULL) \
+        return -1; \
+    for (i = 1; i < num; i++) \
+        lo = (keys[i] < lo) ? keys[i] : lo, hi = (keys[i] > hi) ? keys[i] : hi; \
+    for (i = 0; i < num; i++) { \
+        for (src[i].key = keys[i], src[i].value = values[i], d = 0; d < sizeof(K); d++) \
+            count[d][RADIX_DIGIT(U, keys[i], lo, d)]++; \
+    } \
+    for (d = 0; d < sizeof(K) && ((U)hi - (U)lo) >> 8 * d != 0; d++) { \
+        if (count[d][RADIX_DIGIT(U, keys[0], lo, d)] == num) \
+            continue; \
+        for (sum = i = 0; i < 256; i++) \
+            c = count[d][i], count[d][i] = sum, sum += c; \
+        for (i = 0; i < num; i++) \
+            dst[count[d][RADIX_DIGIT(U, src[i].key, lo, d)]++] = src[i]; \
+        SWAP(src, dst); \
+    } \
+    for (i = 0; i < num; i++) \
+        keys[i] = src[i].key, values[i] = src[i].value; \
+    free((src < dst) ? src : dst); \
+    return 0; \
+}
+RADIX_SORT(radix_sort, int, unsigned int)
+RADIX_SORT(radix_sort64, long long, unsigned long long)
+static void flag_sort_digit(int *keys, int *values, size_t num, int d)
+{
+    size_t count[256] = {0}, next[256], end[256], i, b, sum;
+    int key, value;
+    if (num < 64 || d < 0) {
+        for (i = 1; i < num; i++) {
+            for (key = keys[i], value = values[i], b = i; b > 0 && keys[b - 1] > key; b--)
+                keys[b] = keys[b - 1], values[b] = values[b - 1];
+            keys[b] = key, values[b] = value;
+        }
+        return;
+    }
+    for (i = 0; i < num; i++)
+        count[RADIX_DIGIT(unsigned int, keys[i], INT_MIN, d)]++;
+    for (sum = b = 0; b < 256; b++)
+        next[b] = sum, end[b] = sum += count[b];
+    for (b = 0; b < 256; b++) {
+        while (next[b] < end[b]) {
+            i = RADIX_DIGIT(unsigned int, keys[next[b]], INT_MIN, d);
+            if (i == b) {
+                next[b]++;
+                continue;
+            }
+            SWAP(keys[next[b]], keys[next[i]]);
+            SWAP(values[next[b]], values[next[i]]);
+            next[i]++;
+        }
+    }
+    for (b = 0; b < 256; b++)
+        flag_sort_digit(keys + end[b] - count[b], values + end[b] - count[b], count[b], d - 1);
+}
+static void flag_sort(int *keys, int *values, size_t num) { flag_sort_digit(keys, values, num, sizeof(*keys) - 1); }
+enum { SAMPLE_BUCKETS = 256, SAMPLE_OVER = 16, SAMPLE_CHUNKS = 64, SAMPLE_MIN = 1 << 20 };
+static int sample_sort(int *keys, int *values, size_t num)
+{
+    int *tk, *tv, split[SAMPLE_BUCKETS], sample[SAMPLE_OVER * SAMPLE_BUCKETS], pos[SAMPLE_OVER * SAMPLE_BUCKETS];
+    unsigned char *id;
+    size_t (*count)[SAMPLE_BUCKETS], start[SAMPLE_BUCKETS + 1], i, b, c, sum, s;
+    unsigned long long r = 88172645463325252ULL;
+    for (i = 0; i < SAMPLE_OVER * SAMPLE_BUCKETS; i++) /* Splitters from a sorted random sample. */
+        r = r * 6364136223846793005ULL + 1442695040888963407ULL, sample[i] = (num > 0) ? keys[(r >> 33) % num] : 0, pos[i] = i;
+    flag_sort(sample, pos, SAMPLE_OVER * SAMPLE_BUCKETS);
+    for (s = 1, b = 1; b < SAMPLE_BUCKETS; b++)
+        split[b - 1] = sample[SAMPLE_OVER * b], s += (b > 1 && split[b - 1] != split[b - 2]);
+    if (s < SAMPLE_BUCKETS / 8) /* Few distinct keys, for which the ranges cannot balance the work. */
+        return radix_sort(keys, values, num);
+    tk = malloc(2 * num * sizeof(*tk) + 1), tv = tk + num, id = malloc(num + 1), count = calloc(SAMPLE_CHUNKS, sizeof(*count));
+    if (tk == NULL || id == NULL || count == NULL) {
+        free(tk), free(id), free(count);
+        return -1;
+    }
+    #ifdef _OPENMP
+    #pragma omp parallel for private(i, b, s)
+    #endif
+    for (c = 0; c < SAMPLE_CHUNKS; c++) {
+        for (i = num * c / SAMPLE_CHUNKS; i < num * (c + 1) / SAMPLE_CHUNKS; i++) {
+            for (b = 0, s = SAMPLE_BUCKETS / 2; s > 0; s /= 2) /* Number of splitters <= key. */
+                b += (keys[i] >= split[b + s - 1]) ? s : 0;
+            id[i] = b, count[c][b]++;
+        }
+    }
+    for (sum = b = 0; b < SAMPLE_BUCKETS; b++) {
+        for (start[b] = sum, c = 0; c < SAMPLE_CHUNKS; c++)
+            s = count[c][b], count[c][b] = sum, sum += s;
+    }
+    start[SAMPLE_BUCKETS] = num;
+    #ifdef _OPENMP
+    #pragma omp parallel for private(i, s)
+    #endif
+    for (c = 0; c < SAMPLE_CHUNKS; c++) {
+        for (i = num * c / SAMPLE_CHUNKS; i < num * (c + 1) / SAMPLE_CHUNKS; i++)
+            s = count[c][id[i]]++, tk[s] = keys[i], tv[s] = values[i];
+    }
+    #ifdef _OPENMP
+    #pragma omp parallel for private(s) schedule(dynamic)
+    #endif
+    for (b = 0; b < SAMPLE_BUCKETS; b++) {
+        s = start[b + 1] - start[b];
+        if (radix_sort(tk + start[b], tv + start[b], s) < 0)
+            flag_sort(tk + start[b], tv + start[b], s);
+        memcpy(keys + start[b], tk + start[b], s * sizeof(*keys));
+        memcpy(values + start[b], tv + start[b], s * sizeof(*values));
+    }
+    free(tk), free(id), free(count);
+    return 0;
+}
+
+
+
+/* Sort keys with their values, by sample sort on many threads or radix if memory
+ * allows, else by quicksort. */
 void sort(int *keys, int *values, size_t num)
 {
-    quicksort(keys, keys + num, values);
+#ifdef _OPENMP
+    if (num >= SAMPLE_MIN && sample_sort(keys, values, num) == 0)
+        return;
+#endif
+    if (num == 0 || (num >= 256 && radix_sort(keys, values, num) == 0))
+        return;
+    quicksort(keys, keys + num - 1, values);
     typeof(keys) p, lo = keys, hi = keys + (num < 1024 ? num : 1024);
     for (p = keys + 1; p < hi; p++)
         lo = (*p < *lo) ? p : lo;
@@ -126,8 +477,124 @@ static void Heap_pop(void* base, size_t* num, size_t size, int (*comp)(const voi
 
 
 
+/**
+ * Priority queues specialised at compile time, with the comparison inlined
+ * and a 4-ary layout. O(log n)
+ *
+ * _ Generate the functions for a type, with less(a, b) a macro or function:
+ *   HEAP(Name, type, less)
+ * _ Use them on an array: Name_push(base, &num, key); key = Name_pop(base, &num);
+ * _ For elements whose keys are stored elsewhere, with less(ctx, i, j)
+ *   comparing indices i and j: HEAP_INDEXED(Name, ctx_type, less)
+ * _ Insert i or move it up after its key decreased, returning the new size,
+ *   with pos a -1 initialised array: s = Name_push(heap, pos, ctx, s, i);
+ * _ Extract the top, with s the size after removal: i = Name_pop(heap, pos, ctx, --s);
+ */
+#define HEAP(Name, T, less) \
+static void Name##_push(T* base, size_t* num, T key) { \
+	size_t k = (*num)++, p; \
+	for (; k > 0 && less(key, base[p = (k - 1) / 4]); k = p) \
+		base[k] = base[p]; \
+	base[k] = key; \
+} \
+static T Name##_pop(T* base, size_t* num) { \
+	T top = base[0], key = base[--*num]; \
+	size_t k = 0, c, m, l; \
+	for (; (c = 4 * k + 1) < *num; k = m) { \
+		for (m = c, l = (c + 4 < *num) ? c + 4 : *num; ++c < l;) \
+			m = less(base[c], base[m]) ? c : m; \
+		if (!less(base[m], key)) \
+			break; \
+		base[k] = base[m]; \
+	} \
+	base[k] = key; \
+	return top; \
+}
+#define HEAP_INDEXED(Name, C, less) \
+static int Name##_push(int* heap, int* pos, C ctx, int s, int i) { \
+	int k = (pos[i] < 0) ? s++ : pos[i], p; \
+	for (; k > 0 && less(ctx, i, heap[p = (k - 1) >> 2]); k = p) \
+		heap[k] = heap[p], pos[heap[k]] = k; \
+	heap[k] = i, pos[i] = k; \
+	return s; \
+} \
+static int Name##_pop(int* heap, int* pos, C ctx, int s) { \
+	int top = heap[0], i = heap[s], k = 0, c, m, l; \
+	pos[top] = -1; \
+	for (; (c = 4 * k + 1) < s; k = m) { \
+		for (m = c, l = (c + 4 < s) ? c + 4 : s; ++c < l;) \
+			m = less(ctx, heap[c], heap[m]) ? c : m; \
+		if (!less(ctx, heap[m], i)) \
+			break; \
+		heap[k] = heap[m], pos[heap[k]] = k; \
+	} \
+	if (s > 0) \
+		heap[k] = i, pos[i] = k; \
+	return top; \
+}
+
+
+
+/**
+ * Radix heap for integer keys that never go below the last one extracted,
+ * as in Dijkstra with non-negative costs. O(log C) amortised
+ *
+ * _ Begin with a zero-initialised heap: Radix_heap h = {0};
+ * _ Insert a value, returning -1 if memory ran out: Radix_push(&h, key, value);
+ * _ Extract the smallest key while h.size > 0: Radix_item it = Radix_pop(&h);
+ * _ Release the buckets when done: Radix_free(&h);
+ */
+typedef struct { unsigned int key; int value; } Radix_item;
+typedef struct { unsigned int last; size_t size; struct { Radix_item* d; size_t n, cap; } b[33]; } Radix_heap;
+static inline int Radix_bucket(unsigned int last, unsigned int key) { return (key == last) ? 0 : 32 - __builtin_clz(key ^ last); }
+static int Radix_push(Radix_heap* h, unsigned int key, int value) {
+	assert(key>=h->last);
+	int i = Radix_bucket(h->last, key);
+	Radix_item* d;
+	if (h->b[i].n == h->b[i].cap) {
+		if ((d = realloc(h->b[i].d, (h->b[i].cap * 2 + 16) * sizeof(*d))) == NULL)
+			return -1;
+		h->b[i].d = d, h->b[i].cap = h->b[i].cap * 2 + 16;
+	}
+	h->b[i].d[h->b[i].n++] = (Radix_item){key, value}, h->size++;
+	return 0;
+}
+static Radix_item Radix_pop(Radix_heap* h) {
+	assert(h->size>0);
+	size_t need[33] = {0}, i, j, k, c;
+	unsigned int last;
+	Radix_item *d, it;
+	if (h->b[0].n == 0) {
+		for (i = 1; h->b[i].n == 0; i++);
+		for (last = h->b[i].d[0].key, k = 0, j = 1; j < h->b[i].n; j++)
+			if (h->b[i].d[j].key < last)
+				last = h->b[i].d[j].key, k = j;
+		for (j = 0; j < h->b[i].n; j++)
+			need[Radix_bucket(last, h->b[i].d[j].key)]++;
+		for (j = 0; j < i; j++) { /* Reserve all the room first, so no item is lost. */
+			if (h->b[j].n + need[j] > h->b[j].cap) {
+				c = h->b[j].cap * 2 + need[j] + 16;
+				if ((d = realloc(h->b[j].d, c * sizeof(*d))) == NULL) { /* Take the minimum out and keep the bucket. */
+					it = h->b[i].d[k], h->b[i].d[k] = h->b[i].d[--h->b[i].n], h->size--;
+					return it;
+				}
+				h->b[j].d = d, h->b[j].cap = c;
+			}
+		}
+		for (h->last = last, j = 0; j < h->b[i].n; j++) {
+			it = h->b[i].d[j], c = Radix_bucket(last, it.key);
+			h->b[c].d[h->b[c].n++] = it;
+		}
+		h->b[i].n = 0;
+	}
+	return h->size--, h->b[0].d[--h->b[0].n];
+}
+static void Radix_free(Radix_heap* h) { int i; for (i = 0; i < 33; i++) free(h->b[i].d); memset(h, 0, sizeof(*h)); }
+
+
+
 /* Manage elements in sets (begin with a -1 initialised array). */
-static int  Set_find(int* set, int i) { return (set[i] < 0) ? i : (set[i] = Set_find(set, set[i])); }
+static int  Set_find(int* set, int i) { for (; set[i] >= 0; i = set[i]) if (set[set[i]] >= 0) set[i] = set[set[i]]; return i; }
 static int  Set_test(int* set, int i, int j) { return (Set_find(set, i) == Set_find(set, j)); }
 static int  Set_card(int* set, int i) { return -set[Set_find(set, i)]; }
 static void Set_union(int* set, int i, int j) {
@@ -141,17 +608,158 @@ static void Set_union(int* set, int i, int j) {
 
 
 
-/* Fenwick tree, to keep prefix sums (begin with a zero-initialised array). */
-static int fenwick[1000000];
-static void fenwick_add(int i, int diff) {
-    for (; i < sizeof(fenwick)/sizeof(*fenwick); i |= i + 1)
-        fenwick[i] += diff;
+/**
+ * Same with many threads sharing the sets, lock-free. Roots store -1-rank
+ * instead of the cardinal, and are linked by (rank, index) with a CAS.
+ *
+ * _ Begin with a -1 initialised array: int set[n];
+ * _ Merge from any thread, returning 1 if i and j were in different sets:
+ *   Set_union_atomic(set, i, j);
+ * _ Find the root of an element from any thread: Set_find_atomic(set, i);
+ */
+static int Set_find_atomic(int* set, int i) {
+	int p, q;
+	while ((p = __atomic_load_n(set + i, __ATOMIC_ACQUIRE)) >= 0) {
+		if ((q = __atomic_load_n(set + p, __ATOMIC_ACQUIRE)) < 0)
+			return p;
+		__atomic_compare_exchange_n(set + i, &p, q, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+		i = q;
+	}
+	return i;
 }
-static int fenwick_sum(int i) {
-    int res = 0;
-    for (; i >= 0; i = (i & i + 1) - 1)
-        res += fenwick[i];
-    return res;
+static int Set_union_atomic(int* set, int i, int j) {
+	int a, b, ra, rb, c;
+	while ((a = Set_find_atomic(set, i)) != (b = Set_find_atomic(set, j))) {
+		ra = __atomic_load_n(set + a, __ATOMIC_ACQUIRE), rb = __atomic_load_n(set + b, __ATOMIC_ACQUIRE);
+		if (ra >= 0 || rb >= 0)
+			continue;
+		if (ra < rb || (ra == rb && a > b))
+			c = a, a = b, b = c, c = ra, ra = rb, rb = c;
+		if (__atomic_compare_exchange_n(set + a, &ra, b, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			if (ra == rb)
+				__atomic_compare_exchange_n(set + b, &rb, rb - 1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+
+/**
+ * Fenwick trees on any integer type, to keep prefix sums under updates. The
+ * elements are cut in blocks of FENWICK_BLOCK, each holding a small tree that
+ * spans a few cache lines, under a tree of the block totals. O(log n)
+ *
+ * _ Generate the functions for a type: FENWICK(Fenwick, int) (Fenwick64 for long long)
+ * _ Allocate a tree of n zeros (returns 0, or -1 if memory is lacking): Fenwick f; Fenwick_init(&f, n);
+ * _ Set it from an array in O(n): Fenwick_build(&f, a);
+ * _ Add v at i: Fenwick_add(&f, i, v); get the sum of [0, i): Fenwick_sum(&f, i);
+ * _ Find the first i with a[0] + ... + a[i] >= k (or n), if no element is
+ *   negative: Fenwick_lower(&f, k);
+ * _ Add v over [l, r) and get the sum of [0, i) with two trees:
+ *   Fenwick_range_add(&f, &g, l, r, v); Fenwick_range_sum(&f, &g, i);
+ * _ On a grid of n*m (without blocks): Fenwick_2d g; Fenwick_2d_init(&g, n, m);
+ *   Fenwick_2d_add(&g, i, j, v); Fenwick_2d_sum(&g, i, j) for [0, i)*[0, j);
+ * _ Release the memory when done: Fenwick_free(&f); Fenwick_2d_free(&g);
+ */
+enum { FENWICK_BLOCK = 64 };
+#define FENWICK(Name, T) \
+typedef struct { size_t n, blocks; T *d, *top; } Name; \
+typedef struct { size_t n, m; T *d; } Name##_2d; \
+static void Name##_free(Name *f) { free(f->d), free(f->top), f->d = f->top = NULL; } \
+static int Name##_init(Name *f, size_t n) \
+{ \
+    f->n = n, f->blocks = (n + FENWICK_BLOCK - 1) / FENWICK_BLOCK; \
+    f->d = calloc(n + 1, sizeof(T)), f->top = calloc(f->blocks + 1, sizeof(T)); \
+    if (f->d == NULL || f->top == NULL) { \
+        Name##_free(f); \
+        return -1; \
+    } \
+    return 0; \
+} \
+static void Name##_build(Name *f, const T *a) \
+{ \
+    size_t i, j, base, len; \
+    memcpy(f->d, a, f->n * sizeof(T)); \
+    for (base = 0; base < f->n; base += FENWICK_BLOCK) { \
+        len = umin(FENWICK_BLOCK, f->n - base); \
+        for (f->top[base / FENWICK_BLOCK] = 0, j = 0; j < len; j++) { \
+            f->top[base / FENWICK_BLOCK] += a[base + j]; \
+            if ((j | (j + 1)) < len) \
+                f->d[base + (j | (j + 1))] += f->d[base + j]; \
+        } \
+    } \
+    for (i = 0; i < f->blocks; i++) \
+        if ((i | (i + 1)) < f->blocks) \
+            f->top[i | (i + 1)] += f->top[i]; \
+} \
+static void Name##_add(Name *f, size_t i, T v) \
+{ \
+    size_t j = i % FENWICK_BLOCK, base = i - j, len = umin(FENWICK_BLOCK, f->n - base), b; \
+    for (; j < len; j |= j + 1) \
+        f->d[base + j] += v; \
+    for (b = i / FENWICK_BLOCK; b < f->blocks; b |= b + 1) \
+        f->top[b] += v; \
+} \
+static T Name##_sum(const Name *f, size_t i) \
+{ \
+    size_t j = i % FENWICK_BLOCK, base = i - j, b; \
+    T res = 0; \
+    for (; j > 0; j &= j - 1) \
+        res += f->d[base + j - 1]; \
+    for (b = i / FENWICK_BLOCK; b > 0; b &= b - 1) \
+        res += f->top[b - 1]; \
+    return res; \
+} \
+static size_t Name##_lower(const Name *f, T k) \
+{ \
+    size_t pos = 0, step, base, len; \
+    for (step = 1; step * 2 <= f->blocks; step *= 2); \
+    for (; step > 0; step /= 2) { \
+        if (pos + step <= f->blocks && f->top[pos + step - 1] < k) \
+            pos += step, k -= f->top[pos - 1]; \
+    } \
+    if (pos == f->blocks) \
+        return f->n; \
+    base = pos * FENWICK_BLOCK, len = umin(FENWICK_BLOCK, f->n - base); \
+    for (pos = 0, step = FENWICK_BLOCK; step > 0; step /= 2) { \
+        if (pos + step <= len && f->d[base + pos + step - 1] < k) \
+            pos += step, k -= f->d[base + pos - 1]; \
+    } \
+    return base + pos; \
+} \
+static void Name##_range_add(Name *f, Name *g, size_t l, size_t r, T v) \
+{ \
+    if (l < f->n) \
+        Name##_add(f, l, v), Name##_add(g, l, v * (T)l); \
+    if (r < f->n) \
+        Name##_add(f, r, -v), Name##_add(g, r, -v * (T)r); \
+} \
+static T Name##_range_sum(const Name *f, const Name *g, size_t i) { return Name##_sum(f, i) * (T)i - Name##_sum(g, i); } \
+static void Name##_2d_free(Name##_2d *f) { free(f->d), f->d = NULL; } \
+static int Name##_2d_init(Name##_2d *f, size_t n, size_t m) \
+{ \
+    f->n = n, f->m = m; \
+    return ((f->d = calloc(n * m + 1, sizeof(T))) == NULL) ? -1 : 0; \
+} \
+static void Name##_2d_add(Name##_2d *f, size_t i, size_t j, T v) \
+{ \
+    size_t y; \
+    for (; i < f->n; i |= i + 1) \
+        for (y = j; y < f->m; y |= y + 1) \
+            f->d[i * f->m + y] += v; \
+} \
+static T Name##_2d_sum(const Name##_2d *f, size_t i, size_t j) \
+{ \
+    size_t y; \
+    T res = 0; \
+    for (; i > 0; i &= i - 1) \
+        for (y = j; y > 0; y &= y - 1) \
+            res += f->d[(i - 1) * f->m + y - 1]; \
+    return res; \
 }
+FENWICK(Fenwick, int)
+FENWICK(Fenwick64, long long)
 
 #endif
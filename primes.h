@@ -0,0 +1,325 @@
+/**
+ * Author: Thibault Raffaillac <traf@kth.se>
+ */
+
+#ifndef PRIMES_H
+#define PRIMES_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+/**
+ * Enumerate the primes in [lo, hi) with a segmented sieve of Eratosthenes.
+ * O((hi-lo)*log log hi + sqrt(hi)) time and O(sqrt(hi)) memory
+ *
+ * _ Stream the primes in increasing order to a callback, which receives them
+ *   in slices (one per block of segments) and is never called concurrently,
+ *   returning their count (or -1 on allocation failure):
+ *   void emit(const uint64_t* p, size_t n, void* arg) { ... }
+ *   long long count = Primes_sieve(lo, hi, emit, arg);
+ * _ Only count them with emit set to NULL: Primes_sieve(lo, hi, NULL, NULL);
+ * _ Segments hold one bit per odd number and fit in L1 (PRIMES_SEGMENT bytes).
+ *   They start from a copy of a pattern with the multiples of 3 to 13 already
+ *   removed, then every other sieving prime p crosses its multiples p*m with m
+ *   coprime to 30 (the mod 30 wheel, 8 of every 15 odd multiples).
+ * _ Blocks of PRIMES_BLOCK segments are spread over the OpenMP threads, which
+ *   carry the position of each sieving prime from one segment to the next.
+ * _ hi must not exceed 2^62, and the sieving primes use sqrt(hi)/2 bytes.
+ */
+enum { PRIMES_SEGMENT = 32768, PRIMES_BLOCK = 16, PRIMES_PATTERN = 3 * 5 * 7 * 11 * 13 };
+static const unsigned char Primes_wheel_step[8] = {3, 2, 1, 2, 1, 2, 3, 1}; /* m += 2*step within 1,7,11,13,17,19,23,29 */
+static const unsigned char Primes_wheel_next[30] = {1, 0, 5, 4, 3, 2, 1, 0, 3, 2, 1, 0, 1, 0, 3, 2, 1, 0, 1, 0, 3, 2, 1, 0, 5, 4, 3, 2, 1, 0};
+static const unsigned char Primes_wheel_index[30] = {0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 2, 0, 3, 0, 0, 0, 4, 0, 5, 0, 0, 0, 6, 0, 0, 0, 0, 0, 7};
+static uint64_t* Primes_pattern(void) {
+	static const int small[5] = {3, 5, 7, 11, 13};
+	uint64_t* pat = malloc(PRIMES_PATTERN * sizeof(*pat)), j;
+	int i;
+	if (pat != NULL) { /* Word w holds the odd numbers 128w+1, 128w+3, ..., 128w+127. */
+		memset(pat, 0xff, PRIMES_PATTERN * sizeof(*pat));
+		for (i = 0; i < 5; i++)
+			for (j = small[i] / 2; j < 64 * (uint64_t)PRIMES_PATTERN; j += small[i])
+				pat[j / 64] &= ~((uint64_t)1 << j % 64);
+	}
+	return pat;
+}
+static uint32_t* Primes_base(uint64_t hi, size_t* n) {
+	uint64_t r = hi, i, j;
+	uint32_t* base;
+	char* odd;
+	while (r > 1 && r > hi / r) /* Newton's method for the square root. */
+		r = (r + hi / r) / 2;
+	while (r > 0 && r * r >= hi)
+		r--;
+	if ((odd = calloc(r / 2 + 1, 1)) == NULL)
+		return NULL;
+	for (i = 3; i * i <= r; i += 2)
+		if (!odd[i / 2])
+			for (j = i * i / 2; j <= r / 2; j += i)
+				odd[j] = 1;
+	if ((base = malloc((r / 4 + 2) * sizeof(*base))) != NULL) /* Primes from 17 on, the others are in the pattern. */
+		for (*n = 0, i = 17; i <= r; i += 2)
+			if (!odd[i / 2])
+				base[(*n)++] = i;
+	free(odd);
+	return base;
+}
+static long long Primes_sieve(uint64_t lo, uint64_t hi, void (*emit)(const uint64_t*, size_t, void*), void* arg) {
+	assert(hi<=(uint64_t)1<<62);
+	static const uint64_t two = 2;
+	const size_t words = PRIMES_SEGMENT / 8;
+	uint64_t *pat, first, last, blk;
+	uint32_t* base;
+	size_t nbase = 0;
+	long long count = 0;
+	int failed = 0;
+	if (hi <= lo)
+		return 0;
+	if (lo <= 2 && hi > 2) {
+		if (emit != NULL)
+			emit(&two, 1, arg);
+		count++;
+	}
+	first = lo / 128, last = (hi + 127) / 128; /* Range of words holding the odd numbers in [lo, hi). */
+	pat = Primes_pattern(), base = Primes_base(hi, &nbase);
+	if (pat == NULL || base == NULL) {
+		free(pat), free(base);
+		return -1;
+	}
+	#ifdef _OPENMP
+	#pragma omp parallel reduction(+:count)
+	#endif
+	{
+		uint64_t *bits = malloc(words * sizeof(*bits)), *out = NULL, *grown, lw, hw, w, x, v, vlo, m, j, len;
+		uint32_t* next = malloc(nbase * sizeof(*next) + 1);
+		unsigned char* wheel = malloc(nbase + 1);
+		size_t i, k, cap = 0, n, ready;
+		int q, ok = (bits != NULL && next != NULL && wheel != NULL);
+		#ifdef _OPENMP
+		#pragma omp for schedule(dynamic) ordered
+		#endif
+		for (blk = first; blk < last; blk += words * PRIMES_BLOCK) {
+			if (!ok)
+				continue;
+			for (lw = blk, k = ready = 0; ok && lw < last && lw < blk + words * PRIMES_BLOCK; lw = hw) {
+				hw = (last - lw < words) ? last : lw + words, len = (hw - lw) * 64, vlo = lw * 128;
+				for (w = lw; w < hw; w += n) { /* Copy the presieved pattern cyclically. */
+					n = PRIMES_PATTERN - w % PRIMES_PATTERN;
+					n = (n < hw - w) ? n : hw - w;
+					memcpy(bits + (w - lw), pat + w % PRIMES_PATTERN, n * sizeof(*bits));
+				}
+				for (i = 0; i < nbase && (uint64_t)base[i] * base[i] < vlo + 2 * len; i++) {
+					uint64_t p = base[i];
+					if (i == ready) { /* First multiple p*m >= vlo with m >= p and m coprime to 30. */
+						m = (vlo + p - 1) / p, ready++;
+						m = (m < p) ? p : m;
+						m += Primes_wheel_next[m % 30];
+						next[i] = (p * m - vlo) / 2, wheel[i] = Primes_wheel_index[m % 30];
+					}
+					for (j = next[i], q = wheel[i]; q != 0 && j < len; j += Primes_wheel_step[q] * p, q = (q + 1) & 7)
+						bits[j / 64] &= ~((uint64_t)1 << j % 64);
+					for (; q == 0 && j + 14 * p < len; j += 15 * p) { /* Whole turns of the wheel. */
+						bits[j / 64] &= ~((uint64_t)1 << j % 64);
+						bits[(j + 3 * p) / 64] &= ~((uint64_t)1 << (j + 3 * p) % 64);
+						bits[(j + 5 * p) / 64] &= ~((uint64_t)1 << (j + 5 * p) % 64);
+						bits[(j + 6 * p) / 64] &= ~((uint64_t)1 << (j + 6 * p) % 64);
+						bits[(j + 8 * p) / 64] &= ~((uint64_t)1 << (j + 8 * p) % 64);
+						bits[(j + 9 * p) / 64] &= ~((uint64_t)1 << (j + 9 * p) % 64);
+						bits[(j + 11 * p) / 64] &= ~((uint64_t)1 << (j + 11 * p) % 64);
+						bits[(j + 14 * p) / 64] &= ~((uint64_t)1 << (j + 14 * p) % 64);
+					}
+					for (; j < len; j += Primes_wheel_step[q] * p, q = (q + 1) & 7)
+						bits[j / 64] &= ~((uint64_t)1 << j % 64);
+					next[i] = j - len, wheel[i] = q; /* Carried over to the next segment of the block. */
+				}
+				if (lw == 0) /* 1 is not prime, while 3 to 13 were removed with the pattern. */
+					bits[0] = (bits[0] & ~(uint64_t)1) | 0x6e;
+				if (lo > vlo) /* Trim the odd numbers before lo and from hi. */
+					for (j = 0; j < len && vlo + 2 * j + 1 < lo; j++)
+						bits[j / 64] &= ~((uint64_t)1 << j % 64);
+				if (hi < vlo + 2 * len)
+					for (j = (hi > vlo) ? (hi - vlo) / 2 : 0; j < len; j++)
+						bits[j / 64] &= ~((uint64_t)1 << j % 64);
+				for (n = 0, w = 0; w < hw - lw; w++)
+					n += __builtin_popcountll(bits[w]);
+				count += n;
+				if (emit != NULL) {
+					if (k + n > cap) {
+						if ((grown = realloc(out, (k + n + cap) * sizeof(*out))) == NULL) {
+							ok = 0;
+							break;
+						}
+						out = grown, cap += k + n;
+					}
+					for (w = 0; w < hw - lw; w++)
+						for (x = bits[w], v = vlo + 128 * w + 1; x != 0; x &= x - 1)
+							out[k++] = v + 2 * __builtin_ctzll(x);
+				}
+			}
+			if (emit != NULL && ok) {
+				#ifdef _OPENMP
+				#pragma omp ordered
+				#endif
+				emit(out, k, arg);
+			}
+		}
+		if (!ok) {
+			#ifdef _OPENMP
+			#pragma omp atomic write
+			#endif
+			failed = 1;
+		}
+		free(bits), free(out), free(next), free(wheel);
+	}
+	free(pat), free(base);
+	return failed ? -1 : count;
+}
+
+
+
+/**
+ * Deterministic primality test for 64-bit integers, and factorization by
+ * Pollard's rho with Brent's cycle detection. O(n^1/4) expected per number
+ *
+ * _ Test a number: if (Primes_test(n)) ...
+ * _ Factor a number, getting its k distinct prime factors p in increasing
+ *   order with their exponents e: Primes_factors f; Primes_factor(n, &f);
+ *   0 and 1 have no factors (k is 0).
+ * _ Factor an array of numbers in parallel: Primes_factors f[count];
+ *   Primes_factor_batch(nums, count, f);
+ * _ Miller-Rabin runs with the 7 bases of Jim Sinclair, valid on all 64-bit
+ *   integers, and all modular products use Montgomery multiplication.
+ */
+typedef struct { uint64_t p[15]; unsigned char e[15], k; } Primes_factors;
+typedef struct { uint64_t n, inv, one, r2; } Primes_mont;
+static void Primes_mont_init(Primes_mont* M, uint64_t n) {
+	int i;
+	M->n = n, M->inv = n; /* Newton iterations for n^-1 mod 2^64, n odd. */
+	for (i = 0; i < 5; i++)
+		M->inv *= 2 - n * M->inv;
+	M->one = -n % n;
+	M->r2 = (unsigned __int128)M->one * M->one % n;
+}
+static inline uint64_t Primes_reduce(const Primes_mont* M, unsigned __int128 t) {
+	uint64_t m = (uint64_t)t * M->inv, h = (unsigned __int128)m * M->n >> 64, r = (t >> 64) - h;
+	return ((t >> 64) < h) ? r + M->n : r;
+}
+static inline uint64_t Primes_mul(const Primes_mont* M, uint64_t a, uint64_t b) { return Primes_reduce(M, (unsigned __int128)a * b); }
+static inline uint64_t Primes_add(const Primes_mont* M, uint64_t a, uint64_t b) { return (a >= M->n - b) ? a - (M->n - b) : a + b; }
+static int Primes_test(uint64_t n) {
+	static const uint64_t bases[7] = {2, 325, 9375, 28178, 450775, 9780504, 1795265022};
+	static const unsigned char small[15] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47};
+	Primes_mont M;
+	uint64_t d, x, minus;
+	int i, r, s;
+	for (i = 0; i < 15; i++)
+		if (n % small[i] == 0)
+			return n == small[i];
+	if (n < 53 * 53)
+		return n > 1;
+	Primes_mont_init(&M, n);
+	r = __builtin_ctzll(n - 1), d = (n - 1) >> r, minus = M.n - M.one;
+	for (i = 0; i < 7; i++) {
+		if (bases[i] % n == 0)
+			continue;
+		uint64_t a = Primes_mul(&M, bases[i] % n, M.r2), y = M.one;
+		for (x = d; x > 0; x >>= 1, a = Primes_mul(&M, a, a)) /* y = a^d */
+			if (x & 1)
+				y = Primes_mul(&M, y, a);
+		if (y == M.one)
+			continue;
+		for (s = 1; y != minus && s < r; s++) /* Reaching 1 without -1 proves n composite. */
+			y = Primes_mul(&M, y, y);
+		if (y != minus)
+			return 0;
+	}
+	return 1;
+}
+static uint64_t Primes_gcd(uint64_t a, uint64_t b) {
+	uint64_t t;
+	int k;
+	if (a == 0 || b == 0)
+		return a | b;
+	k = __builtin_ctzll(a | b), a >>= __builtin_ctzll(a);
+	do {
+		b >>= __builtin_ctzll(b);
+		if (a > b)
+			t = a, a = b, b = t;
+		b -= a;
+	} while (b != 0);
+	return a << k;
+}
+static uint64_t Primes_rho(uint64_t n) {
+	Primes_mont M;
+	uint64_t c, x, y, ys, q, g, i, k, r;
+	const uint64_t batch = 128;
+	Primes_mont_init(&M, n);
+	for (c = M.one; ; c = Primes_add(&M, c, M.one)) { /* Brent's variant on y -> y^2+c, with batched gcds. */
+		y = Primes_add(&M, M.one, M.one), q = M.one, g = 1;
+		for (r = 1; g == 1; r *= 2) {
+			for (x = y, i = 0; i < r; i++)
+				y = Primes_add(&M, Primes_mul(&M, y, y), c);
+			for (k = 0; k < r && g == 1; k += batch) {
+				for (ys = y, i = 0; i < batch && i < r - k; i++) {
+					y = Primes_add(&M, Primes_mul(&M, y, y), c);
+					q = Primes_mul(&M, q, (x > y) ? x - y : y - x);
+				}
+				g = Primes_gcd(q, n);
+			}
+		}
+		if (g == n) /* The batch overshot, so retry it one step at a time. */
+			for (g = 1; g == 1; ) {
+				ys = Primes_add(&M, Primes_mul(&M, ys, ys), c);
+				g = Primes_gcd((x > ys) ? x - ys : ys - x, n);
+			}
+		if (g != n)
+			return g;
+	}
+}
+static void Primes_factor(uint64_t n, Primes_factors* f) {
+	static const unsigned char small[15] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47};
+	uint64_t stack[64], d;
+	int i, j, s = 0;
+	assert(f!=NULL);
+	f->k = 0;
+	if (n == 0) /* Every prime divides 0, so like 1 it gets no factors. */
+		return;
+	for (i = 0; i < 15; i++) { /* Trial division first. */
+		if (n % small[i] == 0)
+			for (f->p[f->k] = small[i], f->e[f->k++] = 0; n % small[i] == 0; n /= small[i])
+				f->e[f->k - 1]++;
+	}
+	if (n > 1)
+		stack[s++] = n;
+	while (s > 0) { /* Split the composites until only primes remain. */
+		if (Primes_test(n = stack[--s])) {
+			for (i = 0; i < f->k && f->p[i] != n; i++);
+			if (i == f->k)
+				f->p[f->k] = n, f->e[f->k++] = 0;
+			f->e[i]++;
+		} else {
+			d = Primes_rho(n), stack[s++] = d, stack[s++] = n / d;
+		}
+	}
+	for (i = 1; i < f->k; i++) { /* Insertion sort of the factors. */
+		uint64_t p = f->p[i];
+		unsigned char e = f->e[i];
+		for (j = i; j > 0 && f->p[j - 1] > p; j--)
+			f->p[j] = f->p[j - 1], f->e[j] = f->e[j - 1];
+		f->p[j] = p, f->e[j] = e;
+	}
+}
+static void Primes_factor_batch(const uint64_t* nums, size_t count, Primes_factors* f) {
+	assert(nums!=NULL&&f!=NULL);
+	size_t i;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic, 64)
+	#endif
+	for (i = 0; i < count; i++)
+		Primes_factor(nums[i], f + i);
+}
+
+#endif
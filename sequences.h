@@ -6,8 +6,10 @@
 #define SEQUENCES_H
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include "misc.h"
 
 
 
@@ -45,39 +47,142 @@ static int lis(Lis_item* a, int n) {
 
 
 /**
- * Solver for the 0/1 knapsack problem.
+ * Find a longest increasing subsequence of an int array, keeping the last value
+ * of the best subsequence of each length in a contiguous array searched with a
+ * branchless binary search. O(n*log n)
+ *
+ * _ Get the length of the lis, and the indices of its values in increasing
+ *   order into seq[n] (returns -1 if memory is lacking): int l = lis_array(a, n, seq);
+ */
+static int lis_array(const int* a, int n, int* seq) {
+	assert(a!=NULL&&seq!=NULL);
+	int *tail = malloc(3 * (size_t)n * sizeof(int) + 1), *last = tail + n, *prev = last + n;
+	int i, j, l = 0, base, len, half;
+	if (tail == NULL)
+		return -1;
+	for (i = 0; i < n; i++) {
+		for (base = 0, len = l; len > 1; len -= half) {
+			half = len / 2;
+			base = (tail[base + half] < a[i]) ? base + half : base;
+		}
+		base += (l > 0 && tail[base] < a[i]);
+		tail[base] = a[i], last[base] = i, prev[i] = (base > 0) ? last[base - 1] : -1;
+		l += (base == l);
+	}
+	for (i = l, j = (l > 0) ? last[l - 1] : -1; i-- > 0; j = prev[j])
+		seq[i] = j;
+	free(tail);
+	return l;
+}
+
+
+
+/**
+ * Length of a longest common subsequence of two byte strings, with the
+ * bit-parallel algorithm of Allison-Dix/Hyyro on 64 positions per machine word. O(m*n/64)
+ *
+ * _ Get the length (or -1 if memory is lacking): lcs_length(a, m, b, n);
+ * _ Only the bytes appearing in a get a mask of ceil(m/64) words.
+ */
+static long lcs_length(const char* a, size_t m, const char* b, size_t n) {
+	assert(a!=NULL&&b!=NULL);
+	size_t words = (m + 63) / 64, i, j, k, sigma = 0;
+	int id[256];
+	uint64_t *mask, *v, *mk, u, x, carry;
+	long res = 0;
+	memset(id, -1, sizeof(id));
+	for (i = 0; i < m; i++)
+		if (id[(unsigned char)a[i]] < 0)
+			id[(unsigned char)a[i]] = sigma++;
+	if ((mask = calloc((sigma + 1) * words + 1, sizeof(*mask))) == NULL)
+		return -1;
+	for (v = mask + sigma * words, i = 0; i < m; i++)
+		mask[id[(unsigned char)a[i]] * words + i / 64] |= (uint64_t)1 << (i % 64);
+	for (k = 0; k < words; k++)
+		v[k] = ~(uint64_t)0;
+	for (j = 0; j < n; j++) {
+		if (id[(unsigned char)b[j]] < 0)
+			continue;
+		/* V = (V + U) | (V - U) with U = V & M, where V - U = V & ~M never borrows. */
+		for (mk = mask + id[(unsigned char)b[j]] * words, carry = 0, k = 0; k < words; k++) {
+			u = v[k] & mk[k];
+			x = v[k] + u;
+			v[k] = (x + carry) | (v[k] & ~mk[k]);
+			carry = (x < u) | (x + carry < x);
+		}
+	}
+	for (k = 0; k < words; k++)
+		res += __builtin_popcountll(~v[k] & ((k + 1 < words || m % 64 == 0) ? ~(uint64_t)0 : ((uint64_t)1 << (m % 64)) - 1));
+	free(mask);
+	return res;
+}
+
+
+
+/**
+ * Solver for the 0/1 knapsack problem, computing the best profit for every
+ * capacity on two rows (vectorized, and parallel with -fopenmp), and finding
+ * the items by splitting them in halves, in O(c) extra memory. O(n*c)
  *
  * _ Start with an initialized list of items: KSitem it[n];
- * _ Sort it to improve performance: qsort(it, n, sizeof(*it), ks_comp);
- * _ Reduce the gcd of weights to 1 to improve performance further.
- * _ Find the items leading to the highest profit:
- *   KSsack ks[c + 1];
- *   KSnode bt[n * n];
- *   for (int b = ks[ks_solve(n, c)].first; b >= 0; b = bt[b].next)
- *      printf("%d\n", bt[b].id);
+ * _ Reduce the gcd of weights to 1 to improve performance.
+ * _ Get the highest profit within capacity c, and mark the items taken in
+ *   take[n] if not NULL (returns -1 if memory is lacking):
+ *   long profit = ks_solve(it, n, c, take);
+ * _ Find only the reachable sums of weights, into a bitset of c+1 bits from
+ *   misc.h (returns -1 if memory is lacking): Bits sums; subset_sum(w, n, c, &sums);
  */
-static struct KSitem { int p_w, p, w, id; } *it;
-static struct KSsack { int sum, first; } *ks;
-static struct KSnode { int id, next; } *bt;
+typedef struct KSitem { int p_w, p, w, id; } KSitem;
 static inline int ks_comp(const void *a, const void *b) { return ((struct KSitem *)b)->p_w > ((struct KSitem *)a)->p_w; }
 static inline int gcd(unsigned a, unsigned b) { while (b > 0) { int r = a % b; a = b; b = r; } return a; }
-static int ks_solve(int n, int c) {
-	int i, j, w, x, b = 0;
-	memset(ks, -1, (c + 1) * sizeof(*ks));
-	ks[0].sum = 0;
+static long* ks_rows(const KSitem* it, int n, int c, long* row, long* tmp) {
+	int i, w, wi;
+	long pi, *t;
+	memset(row, 0, (c + 1) * sizeof(*row));
 	for (i = 0; i < n; i++) {
-		for (w = c - it[i].w; w >= 0; w--) {
-			if (ks[w].sum >= 0 && ks[w].sum + it[i].p > ks[x = w + it[i].w].sum) {
-				bt[b] = (struct KSnode){it[i].id, ks[w].first};
-				ks[x] = (struct KSsack){ks[w].sum + it[i].p, b++};
-			}
-		}
-	}
-	for (w = 0, x = 1; x <= c; x++) {
-		if (ks[x].sum >= ks[w].sum)
-			w = x;
+		if ((wi = it[i].w) > c || (pi = it[i].p) <= 0)
+			continue;
+		memcpy(tmp, row, wi * sizeof(*row));
+		#pragma omp parallel for simd if(c - wi > 1 << 16)
+		for (w = wi; w <= c; w++)
+			tmp[w] = (row[w - wi] + pi > row[w]) ? row[w - wi] + pi : row[w];
+		t = row, row = tmp, tmp = t;
 	}
-	return w;
+	return row;
+}
+static long ks_split(const KSitem* it, int n, int c, char* take, long* buf) {
+	int mid = n / 2, k, best;
+	long *f, *g, profit;
+	if (n <= 1)
+		return (n == 1 && (take[0] = (it[0].w <= c && it[0].p > 0))) ? it[0].p : 0;
+	f = ks_rows(it, mid, c, buf, buf + c + 1);
+	g = ks_rows(it + mid, n - mid, c, buf + 2 * (c + 1), buf + 3 * (c + 1));
+	for (best = k = 0; k <= c; k++)
+		if (f[k] + g[c - k] > f[best] + g[c - best])
+			best = k;
+	profit = f[best] + g[c - best];
+	ks_split(it, mid, best, take, buf);
+	ks_split(it + mid, n - mid, c - best, take + mid, buf);
+	return profit;
+}
+static long ks_solve(const KSitem* it, int n, int c, char* take) {
+	assert(it!=NULL&&n>=0&&c>=0);
+	long* buf = malloc(((take != NULL) ? 4 : 2) * ((size_t)c + 1) * sizeof(*buf)), profit;
+	if (buf == NULL)
+		return -1;
+	profit = (take != NULL) ? ks_split(it, n, c, take, buf) : ks_rows(it, n, c, buf, buf + c + 1)[c];
+	free(buf);
+	return profit;
+}
+static int subset_sum(const int* w, int n, int c, Bits* sums) {
+	assert(w!=NULL&&sums!=NULL&&c>=0);
+	int i;
+	if (Bits_init(sums, c + 1) != 0)
+		return -1;
+	for (Bits_set(sums, 0), i = 0; i < n; i++)
+		if (w[i] <= c)
+			Bits_or_shl(sums, sums, w[i]);
+	return 0;
 }
 
 
@@ -110,4 +215,86 @@ static int Interval_cover(Interval* base[], int n, Interval_bound A, Interval_bo
 	return num;
 }
 
+
+
+/**
+ * Minimal interval coverage for many queries, with an index storing for each
+ * interval the one chosen greedily after it, and jump tables to follow 2^k
+ * such steps at once. O(n*log n) to build, O(log n) per query
+ *
+ * _ Build the index over an array of Interval pointers, which gets sorted
+ *   (returns 0, or -1 if memory is lacking): Interval_index idx; Interval_index_init(&idx, p, n);
+ * _ Get the number of intervals covering [A, B] (0 if impossible), and these
+ *   intervals into cover[] if not NULL: int num = Interval_query(&idx, A, B, cover);
+ * _ Answer q queries at once, faster when sorted by A:
+ *   Interval_query_batch(&idx, A, B, q, res);
+ */
+typedef struct { int n, levels, *best, *up; Interval** base; } Interval_index;
+static void Interval_index_free(Interval_index* idx) { free(idx->best), free(idx->up), idx->best = idx->up = NULL; }
+static int Interval_rank(const Interval_index* idx, Interval_bound A) {
+	int lo = 0, hi = idx->n, mid;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (idx->base[mid]->a <= A)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+static int Interval_index_init(Interval_index* idx, Interval* base[], int n) {
+	assert(idx!=NULL&&base!=NULL&&n>=0);
+	int i, j, k;
+	for (idx->levels = 1; (1 << idx->levels) < n; idx->levels++);
+	idx->n = n, idx->base = base;
+	idx->best = malloc(n * sizeof(int) + 1), idx->up = malloc((size_t)n * idx->levels * sizeof(int) + 1);
+	if (idx->best == NULL || idx->up == NULL) {
+		Interval_index_free(idx);
+		return -1;
+	}
+	qsort(base, n, sizeof(*base), Interval_comp);
+	for (i = 0; i < n; i++)
+		idx->best[i] = (i > 0 && base[idx->best[i - 1]]->b >= base[i]->b) ? idx->best[i - 1] : i;
+	for (i = 0; i < n; i++) { /* Intervals leading nowhere point to themselves. */
+		j = idx->best[Interval_rank(idx, base[i]->b) - 1];
+		idx->up[i] = (base[j]->b > base[i]->b) ? j : i;
+	}
+	for (k = 1; k < idx->levels; k++)
+		for (i = 0; i < n; i++)
+			idx->up[k * n + i] = idx->up[(k - 1) * n + idx->up[(k - 1) * n + i]];
+	return 0;
+}
+static int Interval_cover_from(const Interval_index* idx, int j, Interval_bound A, Interval_bound B, Interval* cover[]) {
+	const int n = idx->n;
+	int k, num = 1, i = j;
+	if (i < 0 || idx->base[i]->b < A)
+		return 0;
+	if (idx->base[i]->b < B) {
+		for (k = idx->levels; k-- > 0; )
+			if (idx->base[idx->up[k * n + i]]->b < B)
+				i = idx->up[k * n + i], num += 1 << k;
+		if (idx->base[idx->up[i]]->b < B)
+			return 0;
+		num++;
+	}
+	for (k = 0; cover != NULL && k < num; k++, j = idx->up[j])
+		cover[k] = idx->base[j];
+	return num;
+}
+static int Interval_query(const Interval_index* idx, Interval_bound A, Interval_bound B, Interval* cover[]) {
+	assert(idx!=NULL&&A<=B);
+	int r = Interval_rank(idx, A);
+	return Interval_cover_from(idx, (r > 0) ? idx->best[r - 1] : -1, A, B, cover);
+}
+static void Interval_query_batch(const Interval_index* idx, const Interval_bound* A, const Interval_bound* B, int q, int* res) {
+	assert(idx!=NULL&&A!=NULL&&B!=NULL&&res!=NULL);
+	int i, r = 0;
+	for (i = 0; i < q; i++) {
+		if (i == 0 || A[i] < A[i - 1])
+			r = Interval_rank(idx, A[i]);
+		for (; r < idx->n && idx->base[r]->a <= A[i]; r++);
+		res[i] = Interval_cover_from(idx, (r > 0) ? idx->best[r - 1] : -1, A[i], B[i], NULL);
+	}
+}
+
 #endif
@@ -1,33 +1,101 @@
 /**
  * Author: Thibault Raffaillac <traf@kth.se>
  */
+#include <stdint.h>
+#include <string.h>
 #include <tmmintrin.h>
 
 
 
 /* SSSE3 string -> integer conversion. */
-static inline int asciitoi(uint8_t **str_p) {
+static inline unsigned int asciitou_sse(const uint8_t *str, unsigned int *digits) {
     static const int8_t srli[26] = {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
         0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1, -1, -1, -1, -1, -1};
     
-    uint8_t *str = *str_p;
-    while (*str - 1 < ' ')
-        str++;
-    int negate = (*str == '-');
-    str += negate;
-    
     __m128i x0 = _mm_sub_epi8(_mm_lddqu_si128((__m128i *)str), _mm_set1_epi8('0'));
     __m128i m = _mm_cmpgt_epi8(_mm_and_si128(x0, _mm_set1_epi8(127)), _mm_set1_epi8(9));
-    unsigned int digits = __builtin_ctz(1 << 10 | _mm_movemask_epi8(m));
-    __m128i x1 = _mm_shuffle_epi8(x0, _mm_lddqu_si128((__m128i *)(srli + digits)));
+    *digits = __builtin_ctz(1 << 10 | _mm_movemask_epi8(m));
+    __m128i x1 = _mm_shuffle_epi8(x0, _mm_lddqu_si128((__m128i *)(srli + *digits)));
     __m128i x2 = _mm_maddubs_epi16(x1,
         _mm_set_epi8(0, 0, 0, 0, 0, 0, 1, 10, 1, 10, 1, 10, 1, 10, 10, 100));
     typedef int32_t v4si __attribute__((vector_size(16)));
     v4si x3 = (v4si)_mm_madd_epi16(x2,
         _mm_set_epi16(0, 0, 0, 1, 100, 10000, 1000, 10000));
+    return x3[0] * 1000 + x3[1] + x3[2];
+}
+static inline int asciitoi(uint8_t **str_p) {
+    uint8_t *str = *str_p;
+    while (*str - 1 < ' ')
+        str++;
+    int negate = (*str == '-');
+    str += negate;
+    
+    unsigned int digits, res = asciitou_sse(str, &digits);
     *str_p = str + digits;
-    return ((x3[0] * 1000 + x3[1] + x3[2]) ^ -negate) + negate;
+    return (res ^ -negate) + negate;
+}
+
+
+
+/**
+ * Conversion of all the integers in a buffer (e.g. a mmap'd file), never
+ * reading past str + len, returning the number of values written to dst.
+ * A number is a run of digits, negative if directly preceded by '-', and every
+ * other byte separates numbers (values that overflow wrap around).
+ * Digits are found 64 bytes at a time with SSE2 into a bitmask, whose runs give
+ * the start and length of every number without scanning it, and the digits are
+ * then converted with SSSE3 from the 16 bytes ending each number.
+ *
+ * _ size_t n = asciitoi_bulk(str, len, dst); or asciitoll_bulk for long long.
+ */
+static inline uint64_t ascii_digit_mask(const uint8_t *str) {
+    uint64_t m = 0;
+    for (int k = 0; k < 4; k++) {
+        __m128i d = _mm_sub_epi8(_mm_loadu_si128((__m128i *)(str + 16 * k)), _mm_set1_epi8('0'));
+        m |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d)) << 16 * k;
+    }
+    return m;
+}
+static uint64_t ascii_digit_mask_tail(const uint8_t *str, size_t len) {
+    uint8_t buf[64] = {0}; /* So that no load goes past the end. */
+    return ascii_digit_mask(memcpy(buf, str, len));
+}
+static inline uint64_t ascii_digits(const uint8_t *str, size_t p, size_t len) {
+    static const uint8_t last[32] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255};
+    uint64_t res = 0;
+    if (len <= 16 && p + len >= 16) { /* The 16 bytes ending the number, keeping its len digits. */
+        __m128i x = _mm_sub_epi8(_mm_loadu_si128((__m128i *)(str + p + len - 16)), _mm_set1_epi8('0'));
+        x = _mm_and_si128(x, _mm_loadu_si128((__m128i *)(last + len)));
+        x = _mm_madd_epi16(_mm_maddubs_epi16(x, _mm_set1_epi16(0x010a)), _mm_set1_epi32(0x00010064));
+        x = _mm_madd_epi16(_mm_packs_epi32(x, x), _mm_set1_epi32(0x00012710));
+        return (uint64_t)(uint32_t)_mm_cvtsi128_si32(x) * 100000000 + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(x, 4));
+    }
+    for (size_t i = p; i < p + len; i++) /* Close to the start of the buffer, or beyond 16 digits. */
+        res = res * 10 + str[i] - '0';
+    return res;
+}
+#define ASCII_BULK(name, T) \
+static size_t name(const uint8_t *str, size_t len, T *dst) { \
+    uint64_t m, next = (len >= 64) ? ascii_digit_mask(str) : ascii_digit_mask_tail(str, len), starts, run, carry = 0; \
+    size_t n = 0, b, p, l; \
+    for (b = 0; b < len; b += 64) { \
+        m = next, next = (b + 128 <= len) ? ascii_digit_mask(str + b + 64) : (b + 64 < len) ? ascii_digit_mask_tail(str + b + 64, len - b - 64) : 0; \
+        for (starts = m & ~(m << 1 | carry), carry = m >> 63; starts != 0; starts &= starts - 1) { \
+            p = __builtin_ctzll(starts); \
+            run = (p == 0) ? m : m >> p | next << (64 - p); /* Digits from p on, over two blocks. */ \
+            if (~run != 0) \
+                l = __builtin_ctzll(~run), p += b; \
+            else \
+                for (p += b, l = 64; p + l < len && (unsigned int)(str[p + l] - '0') <= 9; l++); \
+            uint64_t v = ascii_digits(str, p, l), neg = 0 - (uint64_t)(str[p - (p > 0)] == '-'); \
+            dst[n++] = (T)((v ^ neg) - neg); /* Branchless, as signs are unpredictable. */ \
+        } \
+    } \
+    return n; \
 }
+ASCII_BULK(asciitoi_bulk, int)
+ASCII_BULK(asciitoll_bulk, long long)
 
 
 
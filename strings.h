@@ -6,8 +6,26 @@
 #define STRINGS_H
 
 #include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
+
+
+
+/* Define these before including to send the matches elsewhere than stdout. */
+#ifndef KMP_report
+#define KMP_report(s) printf("%d\n", (int)(s))
+#endif
+#ifndef GKMP_report
+#define GKMP_report(s, e) printf("%ld, %ld\n", (long)(s), (long)(e))
+#endif
 
 
 
@@ -37,7 +55,7 @@ static void KMP_find(const KMP_item* sub, const char* str) {
 		for (; i != NULL && i->value != str[s]; i = i->back);
 		i = (i == NULL) ? sub : i + 1;
 		if (i->value == '\0') {
-			printf("%d\n", s);
+			KMP_report(s);
 			i = i->back; /* sub here to disable overlapping detection */
 		}
 	}
@@ -45,6 +63,34 @@ static void KMP_find(const KMP_item* sub, const char* str) {
 
 
 
+/**
+ * Same on a stream of chunks, skipping with memchr (vectorized in libc) to the
+ * next occurence of the first character whenever no match is in progress.
+ *
+ * _ Begin with the state at the start of sub: const KMP_item* state = sub;
+ * _ Feed each chunk with its offset in the stream, found(arg, pos) being called
+ *   with the position of the last character of each occurence:
+ *   state = KMP_feed(sub, state, buf, len, offset, found, arg);
+ */
+static const KMP_item* KMP_feed(const KMP_item* sub, const KMP_item* i, const char* buf, size_t len, size_t offset, void (*found)(void*, size_t), void* arg) {
+	assert(sub!=NULL&&sub->value!='\0'&&i!=NULL&&buf!=NULL&&found!=NULL);
+	const char* p;
+	size_t s;
+	for (s = 0; s < len; s++) {
+		if (i == sub && (p = memchr(buf + s, sub->value, len - s)) == NULL)
+			break;
+		if (i == sub)
+			s = p - buf;
+		for (; i != NULL && i->value != buf[s]; i = i->back);
+		i = (i == NULL) ? sub : i + 1;
+		if (i->value == '\0')
+			found(arg, offset + s), i = i->back;
+	}
+	return i;
+}
+
+
+
 /**
  * Find occurences of a set of substrings in many strings. O(n)
  *
@@ -89,8 +135,417 @@ void GKMP_find(const GKMP_item* start, const GKMP_end* ends, const char* str) {
 		if (i == NULL)
 			i = start;
 		else for (e = i->end, i = i->next; e >= 0; e = ends[e].next)
-			printf("%ld, %ld\n", s, e);
+			GKMP_report(s, e);
+	}
+}
+
+
+
+/**
+ * Flatten the automaton from GKMP_init into a table with one move per state
+ * and class of bytes (those used in no substring sharing a class), so that
+ * each character costs one lookup. Reachable states are numbered in breadth
+ * first order, keeping the shallow ones close in cache. O(s*classes)
+ * Beyond GKMP_DENSE_MAX bytes of table, each state keeps instead a bitmap of
+ * the classes where its move differs from a full row shared along its back
+ * chain, and these moves packed in order (8 bytes each, plus 16 bytes per state
+ * and 64 classes), getting its own full row when over classes/4 moves differ.
+ *
+ * _ Compile it after GKMP_init, returning 0 on success:
+ *   GKMP_dfa dfa; GKMP_compile(&dfa, storage, s, start);
+ * _ Begin with the state at dfa.start, and feed each chunk with its offset in
+ *   the stream, found(arg, pos, string_index) being called for each occurence:
+ *   state = GKMP_run(&dfa, ends, state, buf, len, offset, found, arg);
+ * _ Release the table when done: GKMP_free_dfa(&dfa);
+ */
+#ifndef GKMP_DENSE_MAX
+#define GKMP_DENSE_MAX ((size_t)1 << 28)
+#endif
+typedef struct { int next, end; } GKMP_move;
+typedef struct { uint64_t bits; int rank, row; } GKMP_mask;
+typedef struct { int classes, start, words; unsigned char cls[256]; GKMP_move *moves, *rows; GKMP_mask* masks; } GKMP_dfa;
+static void GKMP_order(const GKMP_item* storage, size_t s, int* order, int* stack, char* done) {
+	const GKMP_item* i;
+	size_t k, n = 0;
+	int top;
+	for (k = 0; k < s; k++) { /* Each item after its back chain, without recursing down the chain. */
+		for (top = 0, i = storage + k; i != NULL && !done[i - storage]; i = i->back)
+			stack[top++] = i - storage, done[i - storage] = 1;
+		while (top > 0)
+			order[n++] = stack[--top];
+	}
+}
+static int GKMP_compile_dense(GKMP_dfa* d, const GKMP_item* storage, size_t s, int* order, int* id) {
+	const GKMP_item* i;
+	GKMP_move *row, *rows;
+	int n = 1, j, c;
+	size_t k;
+	if ((d->moves = malloc(s * d->classes * sizeof(*d->moves))) == NULL)
+		return -1;
+	for (k = 0; k < s; k++) {
+		i = storage + order[k], row = d->moves + (size_t)order[k] * d->classes;
+		if (i->back != NULL)
+			memcpy(row, d->moves + (size_t)(i->back - storage) * d->classes, d->classes * sizeof(*row));
+		else for (c = 0; c < d->classes; c++)
+			row[c].next = d->start, row[c].end = -1;
+		row[d->cls[(unsigned char)i->value]].next = i->next - storage;
+		row[d->cls[(unsigned char)i->value]].end = i->end;
+	}
+	memset(id, -1, s * sizeof(*id));
+	for (id[*order = d->start] = 0, j = 0; j < n; j++) {
+		for (c = 0; c < d->classes; c++) {
+			if (id[d->moves[(size_t)order[j] * d->classes + c].next] < 0)
+				id[order[n] = d->moves[(size_t)order[j] * d->classes + c].next] = n, n++;
+		}
+	}
+	if ((rows = malloc((size_t)n * d->classes * sizeof(*rows))) == NULL)
+		return free(d->moves), -1;
+	for (j = 0; j < n; j++) {
+		for (c = 0; c < d->classes; c++) {
+			rows[(size_t)j * d->classes + c] = d->moves[(size_t)order[j] * d->classes + c];
+			rows[(size_t)j * d->classes + c].next = id[rows[(size_t)j * d->classes + c].next] * d->classes;
+		}
+	}
+	free(d->moves);
+	d->moves = rows, d->start = 0;
+	return 0;
+}
+static int GKMP_compile_sparse(GKMP_dfa* d, const GKMP_item* storage, size_t s, const int* order, int* first, int* count, int* row) {
+	const GKMP_item* i;
+	GKMP_move *moves = malloc(s * sizeof(*moves)), *rows = malloc(d->classes * sizeof(*rows)), *m, *r;
+	unsigned char *key = malloc(s), *k2;
+	size_t used = 0, cap = s, nrows = 1, k, from, to, w;
+	int c, b, limit = d->classes / 4;
+	if (moves == NULL || rows == NULL || key == NULL)
+		return free(moves), free(rows), free(key), -1;
+	for (c = 0; c < d->classes; c++)
+		rows[c].next = d->start, rows[c].end = -1;
+	for (k = 0; k < s; k++) {
+		i = storage + order[k], c = d->cls[(unsigned char)i->value];
+		b = (i->back != NULL) ? i->back - storage : -1;
+		from = (b >= 0) ? (size_t)first[b] : 0, to = (b >= 0) ? from + count[b] : 0;
+		row[order[k]] = (b >= 0) ? row[b] : 0;
+		r = rows + row[order[k]];
+		if (to - from + 1 > (size_t)limit) { /* Too many differences, so a full row of its own. */
+			if ((m = realloc(rows, (nrows + 1) * d->classes * sizeof(*m))) == NULL)
+				return free(moves), free(rows), free(key), -1;
+			rows = m, r = rows + nrows * d->classes;
+			memcpy(r, rows + row[order[k]], d->classes * sizeof(*r));
+			for (; from < to; from++)
+				r[key[from]] = moves[from];
+			r[c].next = i->next - storage, r[c].end = i->end;
+			row[order[k]] = nrows++ * d->classes, first[order[k]] = used, count[order[k]] = 0;
+			continue;
+		}
+		if (used + (to - from) + 1 > cap) {
+			if ((m = realloc(moves, (cap * 2 + to - from) * sizeof(*m))) == NULL)
+				return free(moves), free(rows), free(key), -1;
+			moves = m;
+			if ((k2 = realloc(key, cap * 2 + to - from)) == NULL)
+				return free(moves), free(rows), free(key), -1;
+			key = k2, cap = cap * 2 + to - from;
+		}
+		for (first[order[k]] = used; from < to && key[from] < c; from++)
+			key[used] = key[from], moves[used++] = moves[from];
+		if (i->next - storage != r[c].next || i->end != r[c].end)
+			key[used] = c, moves[used].next = i->next - storage, moves[used++].end = i->end;
+		for (from += (from < to && key[from] == c); from < to; from++)
+			key[used] = key[from], moves[used++] = moves[from];
+		count[order[k]] = used - first[order[k]];
+	}
+	d->words = (d->classes + 63) / 64;
+	if ((d->masks = calloc(s * d->words, sizeof(*d->masks))) == NULL)
+		return free(moves), free(rows), free(key), -1;
+	for (k = 0; k < s; k++) {
+		for (w = 0; w < (size_t)d->words; w++)
+			d->masks[k * d->words + w].rank = first[k], d->masks[k * d->words + w].row = row[k];
+		for (to = first[k] + count[k], from = first[k]; from < to; from++) {
+			d->masks[k * d->words + key[from] / 64].bits |= (uint64_t)1 << key[from] % 64;
+			for (w = key[from] / 64 + 1; w < (size_t)d->words; w++)
+				d->masks[k * d->words + w].rank++;
+		}
+	}
+	free(key);
+	d->moves = moves, d->rows = rows;
+	return 0;
+}
+static int GKMP_compile(GKMP_dfa* d, const GKMP_item* storage, size_t s, const GKMP_item* start) {
+	assert(d!=NULL&&storage!=NULL&&start!=NULL);
+	int *id = malloc(4 * s * sizeof(*id)), *order = id + s, res;
+	char* done = calloc(s, 1);
+	size_t i;
+	memset(d->cls, 0, sizeof(d->cls));
+	for (d->classes = 1, i = 0; i < s; i++) {
+		if (d->cls[(unsigned char)storage[i].value] == 0)
+			d->cls[(unsigned char)storage[i].value] = d->classes++;
 	}
+	d->start = start - storage, d->words = 0, d->rows = NULL, d->masks = NULL;
+	if (id == NULL || done == NULL)
+		return free(id), free(done), -1;
+	GKMP_order(storage, s, order, id, done);
+	if (s * d->classes * sizeof(*d->moves) <= GKMP_DENSE_MAX)
+		res = GKMP_compile_dense(d, storage, s, order, id);
+	else
+		res = GKMP_compile_sparse(d, storage, s, order, id, order + s, order + 2 * s);
+	free(id), free(done);
+	return res;
+}
+static void GKMP_free_dfa(GKMP_dfa* d) { free(d->moves), free(d->rows), free(d->masks), d->moves = d->rows = NULL, d->masks = NULL; }
+static int GKMP_run(const GKMP_dfa* d, const GKMP_end* ends, int state, const char* buf, size_t len, size_t offset, void (*found)(void*, size_t, ssize_t), void* arg) {
+	assert(d!=NULL&&ends!=NULL&&buf!=NULL&&found!=NULL);
+	const GKMP_move* m;
+	const GKMP_mask* k;
+	size_t s;
+	ssize_t e;
+	int c;
+	for (s = 0; s < len; s++) {
+		if (d->masks == NULL) {
+			m = d->moves + state + d->cls[(unsigned char)buf[s]];
+		} else {
+			c = d->cls[(unsigned char)buf[s]], k = d->masks + (size_t)state * d->words + c / 64;
+			m = (k->bits >> c % 64 & 1) ? d->moves + k->rank + __builtin_popcountll(k->bits & (((uint64_t)1 << c % 64) - 1)) : d->rows + k->row + c;
+		}
+		for (state = m->next, e = m->end; e >= 0; e = ends[e].next)
+			found(arg, offset + s, e);
+	}
+	return state;
+}
+
+
+
+/**
+ * Search a whole file with a compiled automaton, mapped in memory and split in
+ * chunks searched in parallel with -fopenmp. Each chunk starts longest-1 bytes
+ * early, so the occurences across boundaries are found exactly once.
+ *
+ * _ Compile the substrings with GKMP_compile (one substring for plain KMP).
+ * _ Get the occurences in order in a malloc'd array, returning their number
+ *   (or -1 on error, leaving hits NULL), with longest the length of the longest
+ *   substring:
+ *   GKMP_hit* hits; ssize_t n = GKMP_search_file(&dfa, ends, path, longest, chunks, &hits);
+ */
+typedef struct { size_t pos; ssize_t end; } GKMP_hit;
+typedef struct { GKMP_hit* d; size_t n, cap, from; int failed; } GKMP_hits;
+static void GKMP_collect(void* arg, size_t pos, ssize_t end) {
+	GKMP_hits* h = arg;
+	GKMP_hit* d;
+	if (pos < h->from || h->failed)
+		return;
+	if (h->n == h->cap) {
+		if ((d = realloc(h->d, (h->cap * 2 + 64) * sizeof(*d))) == NULL) {
+			h->failed = 1;
+			return;
+		}
+		h->d = d, h->cap = h->cap * 2 + 64;
+	}
+	h->d[h->n].pos = pos, h->d[h->n++].end = end;
+}
+static ssize_t GKMP_search_file(const GKMP_dfa* d, const GKMP_end* ends, const char* path, size_t longest, int chunks, GKMP_hit** hits) {
+	assert(d!=NULL&&ends!=NULL&&path!=NULL&&longest>0&&chunks>0&&hits!=NULL);
+	GKMP_hits* parts;
+	struct stat st;
+	ssize_t n = 0;
+	size_t from, pre;
+	char* buf;
+	int fd, c;
+	*hits = NULL;
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+		return (fd >= 0) ? close(fd) : 0, -1;
+	if (st.st_size == 0)
+		return close(fd), 0;
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED || (parts = calloc(chunks, sizeof(*parts))) == NULL)
+		return (buf != MAP_FAILED) ? munmap(buf, st.st_size) : 0, -1;
+	madvise(buf, st.st_size, MADV_SEQUENTIAL);
+	#ifdef _OPENMP
+	#pragma omp parallel for private(from, pre) schedule(dynamic)
+	#endif
+	for (c = 0; c < chunks; c++) {
+		parts[c].from = from = (size_t)st.st_size * c / chunks;
+		pre = (from < longest - 1) ? from : longest - 1;
+		GKMP_run(d, ends, d->start, buf + from - pre, (size_t)st.st_size * (c + 1) / chunks - from + pre, from - pre, GKMP_collect, parts + c);
+	}
+	for (c = 0; c < chunks; c++)
+		n = (parts[c].failed || n < 0) ? -1 : n + (ssize_t)parts[c].n;
+	if (n > 0 && (*hits = malloc(n * sizeof(**hits))) == NULL)
+		n = -1;
+	for (n = (n < 0) ? -1 : 0, c = 0; c < chunks; c++) {
+		if (n >= 0 && parts[c].n > 0)
+			memcpy(*hits + n, parts[c].d, parts[c].n * sizeof(**hits)), n += parts[c].n;
+		free(parts[c].d);
+	}
+	free(parts);
+	munmap(buf, st.st_size);
+	return n;
+}
+
+
+
+/**
+ * Build the suffix array of a string of n bytes with SA-IS, storing 32-bit
+ * indices, then its LCP array with Kasai. O(n)
+ *
+ * _ Begin with sa an array of n uint32_t, and n < UINT32_MAX
+ * _ Build it (returns 0, or -1 if memory is lacking): SA_build(str, n, sa);
+ * _ Build lcp, lcp[i] being the longest common prefix of the suffixes sa[i]
+ *   and sa[i+1], into an array of n-1 uint32_t: SA_lcp(str, n, sa, lcp);
+ * _ Count the occurences of pat, located at sa[first..first+count) (O(m log n)):
+ *   size_t count = SA_find(str, n, sa, pat, m, &first);
+ * _ Get the longest repeated substring: size_t len = SA_repeated(sa, lcp, n, &pos);
+ * _ Count the distinct substrings: SA_distinct(lcp, n);
+ */
+#define SA_NIL UINT32_MAX
+#define SA_chr(i) (cs ? ((const uint32_t*)s)[i] : ((const unsigned char*)s)[i])
+#define SA_ls(i) ((ls[(i) >> 3] >> ((i) & 7)) & 1)
+static void SA_induce(const void* s, int cs, uint32_t* sa, uint32_t n, uint32_t upper, const uint8_t* ls, const uint32_t* sum_l, const uint32_t* sum_s, uint32_t* buf, const uint32_t* lms, uint32_t m) {
+	uint32_t i, v;
+	memset(sa, 0xff, n * sizeof(*sa));
+	memcpy(buf, sum_s, (upper + 1) * sizeof(*buf));
+	for (i = 0; i < m; i++)
+		sa[buf[SA_chr(lms[i])]++] = lms[i];
+	memcpy(buf, sum_l, (upper + 1) * sizeof(*buf));
+	sa[buf[SA_chr(n - 1)]++] = n - 1;
+	for (i = 0; i < n; i++)
+		if ((v = sa[i]) != SA_NIL && v > 0 && !SA_ls(v - 1))
+			sa[buf[SA_chr(v - 1)]++] = v - 1;
+	memcpy(buf, sum_l, (upper + 1) * sizeof(*buf));
+	for (i = n; i-- > 0; )
+		if ((v = sa[i]) != SA_NIL && v > 0 && SA_ls(v - 1))
+			sa[--buf[SA_chr(v - 1) + 1]] = v - 1;
+}
+static int SA_is(const void* s, int cs, uint32_t* sa, uint32_t n, uint32_t upper) {
+	uint32_t *sum_l, *sum_s, *buf, *lms, *map, *rec, i, m = 0, l, r, el, er, name;
+	uint8_t* ls;
+	int same, res = -1;
+	if (n <= 2) {
+		if (n == 1)
+			sa[0] = 0;
+		else if (n == 2)
+			sa[0] = (SA_chr(0) >= SA_chr(1)), sa[1] = !sa[0];
+		return 0;
+	}
+	ls = calloc(n / 8 + 1, 1);
+	sum_l = calloc(upper + 2, sizeof(*sum_l));
+	sum_s = calloc(upper + 2, sizeof(*sum_s));
+	buf = malloc((upper + 2) * sizeof(*buf));
+	map = malloc(n * sizeof(*map));
+	if (ls == NULL || sum_l == NULL || sum_s == NULL || buf == NULL || map == NULL)
+		goto fail_map;
+	for (i = n - 1; i-- > 0; )
+		if (SA_chr(i) < SA_chr(i + 1) || (SA_chr(i) == SA_chr(i + 1) && SA_ls(i + 1)))
+			ls[i >> 3] |= 1 << (i & 7);
+	for (i = 0; i < n; i++)
+		SA_ls(i) ? sum_l[SA_chr(i) + 1]++ : sum_s[SA_chr(i)]++;
+	for (i = 0; i <= upper; i++)
+		sum_s[i] += sum_l[i], sum_l[i + 1] += sum_s[i];
+	for (map[0] = SA_NIL, i = 1; i < n; i++)
+		map[i] = (!SA_ls(i - 1) && SA_ls(i)) ? m++ : SA_NIL;
+	if ((lms = malloc((m + 1) * sizeof(*lms))) == NULL)
+		goto fail_map;
+	for (i = 1; i < n; i++)
+		if (map[i] != SA_NIL)
+			lms[map[i]] = i;
+	lms[m] = n;
+	SA_induce(s, cs, sa, n, upper, ls, sum_l, sum_s, buf, lms, m);
+	if (m > 0) {
+		/* The LMS substrings are now sorted: name them in the upper part of sa,
+		 * which the sorted LMS positions leave free. */
+		for (l = 0, i = 0; i < n; i++)
+			if (map[sa[i]] != SA_NIL)
+				sa[l++] = sa[i];
+		for (name = 0, i = 0; i < m; i++) {
+			if (i > 0) {
+				l = sa[i - 1], r = sa[i];
+				el = lms[map[l] + 1], er = lms[map[r] + 1];
+				same = (el - l == er - r);
+				for (; same && l < el && SA_chr(l) == SA_chr(r); l++, r++);
+				name += !same || l == n || r == n || SA_chr(l) != SA_chr(r);
+			}
+			sa[m + map[sa[i]]] = name;
+		}
+		free(map), map = NULL;
+		if ((rec = malloc(m * sizeof(*rec))) == NULL)
+			goto fail_lms;
+		memcpy(rec, sa + m, m * sizeof(*rec));
+		if (SA_is(rec, 1, sa, m, name) < 0) {
+			free(rec);
+			goto fail_lms;
+		}
+		for (i = 0; i < m; i++)
+			rec[i] = lms[sa[i]];
+		SA_induce(s, cs, sa, n, upper, ls, sum_l, sum_s, buf, rec, m);
+		free(rec);
+	}
+	res = 0;
+fail_lms:
+	free(lms);
+fail_map:
+	free(map), free(buf), free(sum_s), free(sum_l), free(ls);
+	return res;
+}
+static int SA_build(const char* str, size_t n, uint32_t* sa) {
+	assert(str!=NULL&&sa!=NULL&&n<SA_NIL);
+	return SA_is(str, 0, sa, n, UCHAR_MAX);
+}
+static int SA_lcp(const char* str, size_t n, const uint32_t* sa, uint32_t* lcp) {
+	assert(str!=NULL&&sa!=NULL&&lcp!=NULL);
+	uint32_t *rank, i, h = 0, j;
+	if (n < 2)
+		return 0;
+	if ((rank = malloc(n * sizeof(*rank))) == NULL)
+		return -1;
+	for (i = 0; i < n; i++)
+		rank[sa[i]] = i;
+	for (i = 0; i < n; i++) {
+		if (rank[i] == n - 1) {
+			h = 0;
+			continue;
+		}
+		for (j = sa[rank[i] + 1]; i + h < n && j + h < n && str[i + h] == str[j + h]; h++);
+		lcp[rank[i]] = h;
+		h -= (h > 0);
+	}
+	free(rank);
+	return 0;
+}
+static int SA_cmp(const char* str, size_t n, uint32_t pos, const char* pat, size_t m) {
+	int c = memcmp(str + pos, pat, (n - pos < m) ? n - pos : m);
+	return (c == 0 && n - pos < m) ? -1 : c;
+}
+static size_t SA_find(const char* str, size_t n, const uint32_t* sa, const char* pat, size_t m, size_t* first) {
+	assert(str!=NULL&&sa!=NULL&&pat!=NULL&&first!=NULL);
+	size_t lo = 0, hi = n, mid;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (SA_cmp(str, n, sa[mid], pat, m) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (*first = lo, hi = n; lo < hi; ) {
+		mid = lo + (hi - lo) / 2;
+		if (SA_cmp(str, n, sa[mid], pat, m) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - *first;
+}
+static size_t SA_repeated(const uint32_t* sa, const uint32_t* lcp, size_t n, size_t* pos) {
+	assert(sa!=NULL&&lcp!=NULL&&pos!=NULL);
+	size_t i, best = 0;
+	for (*pos = 0, i = 0; i + 1 < n; i++)
+		if (lcp[i] > best)
+			best = lcp[i], *pos = sa[i];
+	return best;
+}
+static unsigned long long SA_distinct(const uint32_t* lcp, size_t n) {
+	unsigned long long total = (unsigned long long)n * (n + 1) / 2;
+	size_t i;
+	for (i = 0; i + 1 < n; i++)
+		total -= lcp[i];
+	return total;
 }
 
 #endif